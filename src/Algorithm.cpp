@@ -24,6 +24,21 @@ double bt_fisher_exact(int n11, int n12, int n21, int n22)
     return p;
 }
 
+double FisherCache::FS(int n11, int n12, int n21, int n22)
+{
+    // a zero margin leaves a single possible table, p = 1
+    if (n11 + n12 == 0 || n21 + n22 == 0 || n11 + n21 == 0 || n12 + n22 == 0) return 0.0;
+    if ((n11 | n12 | n21 | n22) >> 16) return bt_fisher_exact(n11, n12, n21, n22);
+    uint64_t key = static_cast<uint64_t>(n11) << 48 | static_cast<uint64_t>(n12) << 32 | static_cast<uint64_t>(n21) << 16 | static_cast<uint64_t>(n22);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+    double p = bt_fisher_exact(n11, n12, n21, n22);
+    if (cache.size() >= max_size) cache.clear();
+    cache.insert({key, p});
+
+    return p;
+}
+
 static double rankR1(const std::vector<double>& x, size_t n1)
 {
     // merge, sort and keep track of index
@@ -52,11 +67,8 @@ static double rankR1(const std::vector<double>& x, size_t n1)
     return r1;
 }
 
-double RankSumTest(std::vector<double>& x, std::vector<double>& y)
+static double rankSumPhred(double r1, size_t n1, size_t n2)
 {
-    size_t n1 = x.size(), n2 = y.size();
-    x.insert(x.end(), y.begin(), y.end());
-    double r1 = rankR1(x, n1);
     double expected = (double)(n1 * (n1 + n2 + 1)) / 2.0;
     double z = (r1 - expected) / std::sqrt(static_cast<double>(n1*n2*(n1+n2+1))/12.0);
     double p = -10 * std::log10(2 * normsf(std::abs(z))); // phred score value
@@ -66,66 +78,237 @@ double RankSumTest(std::vector<double>& x, std::vector<double>& y)
     return p;
 }
 
-static void singleEM(const std::vector<double>& allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, std::vector<double>& expect_allele_prob, int32_t nsample, int ntype)
+double RankSumTest(std::vector<double>& x, std::vector<double>& y)
 {
-    std::vector<double> likelihood(ntype), ind_allele_prob(ntype * nsample);
-    // step E
-    int i, j;
-    for (i = 0; i < nsample; ++i) {
-        for (j = 0; j < ntype; ++j) {
-            likelihood[j] = allele_freq[j] * ind_allele_likelihood[i * ntype + j];
-            marginal_likelihood[i] += likelihood[j];
-        }
-        for (j = 0; j < ntype; ++j) {
-            // col major may be fast for step M
-            // need to deal with marginal_likelihood[i] is close to zero
-            ind_allele_prob[j * nsample + i] = likelihood[j] / marginal_likelihood[i];
+    size_t n1 = x.size(), n2 = y.size();
+    x.insert(x.end(), y.begin(), y.end());
+    return rankSumPhred(rankR1(x, n1), n1, n2);
+}
+
+double RankSumTest(const int32_t* x, const int32_t* y)
+{
+    // the values of bin v take the ranks rank+1 .. rank+x[v]+y[v] and share
+    // their average, so r1 is exact and equal to the sorting version
+    size_t n1 = 0, n2 = 0, rank = 0, c;
+    double r1 = 0.0;
+    for (int v = 0; v < RANK_BINS; ++v) {
+        c = x[v] + y[v];
+        if (c == 0) continue;
+        if (x[v] > 0) r1 += x[v] * ((2 * rank + c + 1) / 2.0);
+        rank += c;
+        n1 += x[v];
+        n2 += y[v];
+    }
+    return rankSumPhred(r1, n1, n2);
+}
+
+static BaseVarC::TaskScheduler* em_sched = NULL;
+static BaseVarC::TaskGroup em_group;
+static int32_t em_min_depth = 0;
+
+void SetEMPool(BaseVarC::TaskScheduler* sched, int32_t min_depth)
+{
+    em_sched = min_depth > 0 ? sched : NULL;
+    em_min_depth = min_depth;
+}
+
+// shared by the caller and the tasks helping with one EM step.
+// blocks are claimed one by one, so tasks that start late find nothing
+// left to do and never touch the caller's data after it returned. the
+// last one holding the job frees it.
+struct EMJob
+{
+    int32_t nblock;
+    std::atomic<int32_t> next;
+    std::atomic<int32_t> done;
+    std::atomic<int32_t> refs;
+    std::function<void(int32_t)> work;
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+static void releaseEMJob(EMJob* job)
+{
+    if (--job->refs == 0) delete job;
+}
+
+static void runEMJob(EMJob* job)
+{
+    int32_t k;
+    while ((k = job->next++) < job->nblock) {
+        job->work(k);
+        if (++job->done == job->nblock) {
+            std::lock_guard<std::mutex> lock(job->m);
+            job->cv.notify_one();
         }
     }
-    // step M
-    for (j = 0; j < ntype; ++j){
-        for (i = 0; i < nsample; ++i){
-            expect_allele_prob[j] += ind_allele_prob[j * nsample + i];
+}
+
+static void helpEMJob(void* ctx, size_t)
+{
+    EMJob* job = static_cast<EMJob*>(ctx);
+    runEMJob(job);
+    releaseEMJob(job);
+}
+
+// E step over samples [b, e) and the partial sums of the posteriors,
+// only the likelihood columns of the K active alleles are touched.
+template <int K>
+static void blockEM(const double* allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, double* partial, const int8_t* cols, int32_t b, int32_t e, int ntype)
+{
+    double likelihood[K];
+    int32_t i;
+    int j;
+    for (j = 0; j < K; ++j) partial[j] = 0.0;
+    for (i = b; i < e; ++i) {
+        const double* il = &ind_allele_likelihood[i * ntype];
+        marginal_likelihood[i] = 0.0;
+        for (j = 0; j < K; ++j) {
+            likelihood[j] = allele_freq[j] * il[cols[j]];
+            marginal_likelihood[i] += likelihood[j];
+        }
+        // need to deal with marginal_likelihood[i] is close to zero
+        for (j = 0; j < K; ++j) {
+            partial[j] += likelihood[j] / marginal_likelihood[i];
         }
-        expect_allele_prob[j] = expect_allele_prob[j] / nsample;
     }
-    return;
 }
 
-static inline void update_allele_freq(std::vector<double>& allele_freq, std::vector<double>& expect_allele_prob, int ntype)
+// map: blocks of EM_BLOCK samples, reduce: sum the blocks in order.
+// the block layout never depends on the pool, so neither does the result.
+template <int K>
+static void singleEM(const double* allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, double* expect_allele_prob, const int8_t* cols, int32_t nsample, int ntype)
 {
-    for(int j = 0; j < ntype; ++j) {
-        allele_freq[j] = expect_allele_prob[j];
-        expect_allele_prob[j] = 0.0;
+    int32_t k, nblock = (nsample + EM_BLOCK - 1) / EM_BLOCK;
+    int j;
+    if (nblock <= 1) {
+        // step E
+        blockEM<K>(allele_freq, ind_allele_likelihood, marginal_likelihood, expect_allele_prob, cols, 0, nsample, ntype);
+    } else {
+        std::vector<double> partial(nblock * K);
+        auto work = [&](int32_t kb) {
+            blockEM<K>(allele_freq, ind_allele_likelihood, marginal_likelihood, &partial[kb * K], cols, kb * EM_BLOCK, std::min(nsample, (kb + 1) * EM_BLOCK), ntype);
+        };
+        if (em_sched && nsample >= em_min_depth) {
+            EMJob* job = new EMJob;
+            int32_t nhelper = std::min(static_cast<int32_t>(em_sched->size()), nblock - 1);
+            job->nblock = nblock;
+            job->next = 0;
+            job->done = 0;
+            job->refs = nhelper + 1;
+            job->work = work;
+            for (k = 0; k < nhelper; ++k) em_sched->submit(em_group, helpEMJob, job, 0);
+            runEMJob(job);
+            // all blocks are taken now, only those already running are waited
+            // for. the caller may be a task, it must not wait for queued ones
+            // nor run other tasks with its worker's state half used
+            {
+                std::unique_lock<std::mutex> lock(job->m);
+                job->cv.wait(lock, [job]{ return job->done == job->nblock; });
+            }
+            releaseEMJob(job);
+        } else {
+            for (k = 0; k < nblock; ++k) work(k);
+        }
+        for (j = 0; j < K; ++j) expect_allele_prob[j] = 0.0;
+        for (k = 0; k < nblock; ++k) {
+            for (j = 0; j < K; ++j) expect_allele_prob[j] += partial[k * K + j];
+        }
+    }
+    // step M
+    for (j = 0; j < K; ++j) {
+        expect_allele_prob[j] = expect_allele_prob[j] / nsample;
     }
+    return;
 }
 
-static double delta_bylog(std::vector<double>& bf, std::vector<double>& af, int nsample)
+template <int K>
+static inline double delta_byfreq(const double* bf, const double* af)
 {
     double delta = 0.0;
-    for(int i = 0; i < nsample; ++i) {
-        // need to deal with log(0) == inf;
-        delta += std::abs(std::log(af[i]) - std::log(bf[i]));
-        bf[i] = af[i];
-        af[i] = 0.0;
+    for (int j = 0; j < K; ++j) {
+        delta = std::max(delta, std::abs(af[j] - bf[j]));
     }
     return delta;
 }
 
-void EM(std::vector<double>& init_allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, std::vector<double>& expect_allele_prob, int32_t nsample, int ntype, int iter_num, double epsilon)
+template <int K>
+static int EMk(double* f0, double* f1, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, const int8_t* cols, int32_t nsample, int ntype, int iter_num, double epsilon)
 {
+    // SQUAREM (Varadhan & Roland, 2008) on top of the plain EM map F:
+    // two EM steps give r = F(f) - f and v = F(F(f)) - 2F(f) + f, then jump
+    // along the extrapolated path and take one more EM step to stabilize.
+    // convergence is checked on the allele frequencies, no logs are needed.
+    double f2[K], r[K], v[K];
     std::vector<double> af_marginal_likelihood(nsample);
-    singleEM(init_allele_freq, ind_allele_likelihood, marginal_likelihood, expect_allele_prob, nsample, ntype);
-    double delta;
-    for(int i = 0; i < iter_num; ++i){
-        update_allele_freq(init_allele_freq, expect_allele_prob, ntype);
-        singleEM(init_allele_freq, ind_allele_likelihood, af_marginal_likelihood, expect_allele_prob, nsample, ntype);
-        delta = delta_bylog(marginal_likelihood, af_marginal_likelihood, nsample);
-        if(delta < epsilon){
-            break;
+    singleEM<K>(f0, ind_allele_likelihood, marginal_likelihood, f1, cols, nsample, ntype);
+    int j, iter = 1;
+    double sr, sv, alpha, fsum;
+    bool feasible;
+    while (iter < iter_num && delta_byfreq<K>(f0, f1) >= epsilon) {
+        singleEM<K>(f1, ind_allele_likelihood, af_marginal_likelihood, f2, cols, nsample, ntype);
+        iter++;
+        sr = 0.0; sv = 0.0;
+        for (j = 0; j < K; ++j) {
+            r[j] = f1[j] - f0[j];
+            v[j] = f2[j] - f1[j] - r[j];
+            sr += r[j] * r[j];
+            sv += v[j] * v[j];
+        }
+        alpha = sv > 0 ? -std::sqrt(sr / sv) : -1.0;
+        if (alpha > -1.0) alpha = -1.0;    // alpha = -1 is exactly F(F(f))
+        feasible = true; fsum = 0.0;
+        for (j = 0; j < K; ++j) {
+            r[j] = f0[j] - 2 * alpha * r[j] + alpha * alpha * v[j];
+            if (r[j] <= 0) feasible = false;
+            fsum += r[j];
+        }
+        if (!feasible || fsum <= 0) {
+            // the jump left the simplex or hit its border, where the
+            // multiplicative EM steps would keep an allele at 0 for good,
+            // fall back to the plain double EM step
+            for (j = 0; j < K; ++j) f0[j] = f2[j];
+        } else {
+            for (j = 0; j < K; ++j) f0[j] = r[j] / fsum;
         }
+        singleEM<K>(f0, ind_allele_likelihood, marginal_likelihood, f1, cols, nsample, ntype);
+        iter++;
     }
 
-    return;
+    return iter;
+}
+
+// a single allele hypothesis has nothing to estimate
+template <>
+int EMk<1>(double* f0, double* f1, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, const int8_t* cols, int32_t nsample, int ntype, int, double)
+{
+    f1[0] = f0[0] > 0 ? 1.0 : 0.0;
+    for (int32_t i = 0; i < nsample; ++i) {
+        marginal_likelihood[i] = f0[0] * ind_allele_likelihood[i * ntype + cols[0]];
+    }
+    return 1;
 }
 
+int EM(std::vector<double>& init_allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, std::vector<double>& expect_allele_prob, const int8_t* cols, int k, int32_t nsample, int ntype, int iter_num, double epsilon)
+{
+    double f0[NTYPE_MAX], f1[NTYPE_MAX];
+    int j, iter = 0;
+    for (j = 0; j < k; ++j) f0[j] = init_allele_freq[cols[j]];
+    switch (k) {
+    case 1 : iter = EMk<1>(f0, f1, ind_allele_likelihood, marginal_likelihood, cols, nsample, ntype, iter_num, epsilon); break;
+    case 2 : iter = EMk<2>(f0, f1, ind_allele_likelihood, marginal_likelihood, cols, nsample, ntype, iter_num, epsilon); break;
+    case 3 : iter = EMk<3>(f0, f1, ind_allele_likelihood, marginal_likelihood, cols, nsample, ntype, iter_num, epsilon); break;
+    case 4 : iter = EMk<4>(f0, f1, ind_allele_likelihood, marginal_likelihood, cols, nsample, ntype, iter_num, epsilon); break;
+    default: throw std::invalid_argument("EM supports 1 to 4 active alleles");
+    }
+    for (j = 0; j < ntype; ++j) {
+        init_allele_freq[j] = 0.0;
+        expect_allele_prob[j] = 0.0;
+    }
+    for (j = 0; j < k; ++j) {
+        init_allele_freq[cols[j]] = f0[j];
+        expect_allele_prob[cols[j]] = f1[j];
+    }
+
+    return iter;
+}
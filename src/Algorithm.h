@@ -2,8 +2,18 @@
 #define BASEVARC_ALGORITHM_H
 
 #include <cmath>
+#include <stdexcept>
+#include <atomic>
+#include <functional>
 #include "BaseVarUtils.h"
+#include "TaskScheduler.h"
 #include "htslib/kfunc.h"
+#include "robin_hood.h"
+
+#define NTYPE_MAX 4
+#define EM_BLOCK 4096    // samples per map-reduce block in EM
+#define FISHER_CACHE_MAX 65536   // tables memoized by FisherCache before it starts over
+#define RANK_BINS 256    // histogram bins of the 8-bit values tested by RankSumTest
 
 double chisf(double x, double k);
 
@@ -12,8 +22,32 @@ double normsf(double x);
 double bt_fisher_exact(int n11, int n12, int n21, int n22);
 
 
+/* per-thread memo of bt_fisher_exact. strand bias tables at low depth are
+ * tiny and repeat constantly, so tables with all counts < 2^16 are kept. */
+class FisherCache
+{
+ public:
+    FisherCache(size_t size = FISHER_CACHE_MAX): max_size(size) {}
+    ~FisherCache() {}
+
+    // same value as bt_fisher_exact(n11, n12, n21, n22)
+    double FS(int n11, int n12, int n21, int n22);
+
+ private:
+    const size_t max_size;
+    robin_hood::unordered_map<uint64_t, double> cache;
+};
+
 double RankSumTest(std::vector<double>& x, std::vector<double>& y);
+// same test on RANK_BINS-bin histograms of 8-bit values, O(n) without sorting
+double RankSumTest(const int32_t* x, const int32_t* y);
+
+// let EM of sites with depth >= min_depth run its blocks as tasks of sched too.
+// sched == NULL or min_depth <= 0 keeps every EM on the calling thread
+void SetEMPool(BaseVarC::TaskScheduler* sched, int32_t min_depth);
 
-void EM(std::vector<double>& init_allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, std::vector<double>& expect_allele_prob, int32_t nsample, int ntype, int iter_num, double epsilon);
+// run EM over the k (<= NTYPE_MAX) alleles listed in cols, the others are kept 0.
+// return the number of EM steps taken
+int EM(std::vector<double>& init_allele_freq, const std::vector<double>& ind_allele_likelihood, std::vector<double>& marginal_likelihood, std::vector<double>& expect_allele_prob, const int8_t* cols, int k, int32_t nsample, int ntype, int iter_num, double epsilon);
 
 #endif
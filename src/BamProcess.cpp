@@ -1,4 +1,5 @@
 #include "BamProcess.h"
+#include <limits>
 
 
 bool BamProcess::FindSnpAtPos(int32_t rg_s, const std::string& refseq, const std::string& rg, const std::vector<int32_t>& pv)
@@ -93,108 +94,138 @@ bool BamProcess::FindSnpAtPos(int32_t rg_s, const std::string& refseq, const std
     return true;
 }
 
-std::string BamProcess::FetchAlleleType(int32_t rg_s, const std::string& refseq, const std::string& rg, const PosInfoVector& pv)
+namespace {
+
+/* the first site in pv[from..] whose position is beyond bound, the sites are
+ * sorted, so step out exponentially and bisect the last step */
+size_t GallopSite(const PosInfoVector& pv, size_t from, int32_t bound)
 {
-    SeqLib::BamRecordVector rv;
-    std::vector<char> snps;
-    snps.reserve(pv.size());
+    size_t lo = from, step = 1, hi;
+    while (true) {
+        hi = lo + step;
+        if (hi >= pv.size()) { hi = pv.size(); break; }
+        if (pv[hi].pos > bound) break;
+        lo = hi; step <<= 1;
+    }
+    if (lo < pv.size() && pv[lo].pos > bound) return lo;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pv[mid].pos > bound) hi = mid;
+        else lo = mid;
+    }
+    return hi;
+}
 
-    if (!GetBRV(rg, rv)) {
+/* walks the CIGAR of one read forward, the sites fed to Code must come in
+ * increasing order, so each operation is visited once per read */
+class CigarCursor
+{
+public:
+    CigarCursor(const SeqLib::BamRecord& r_): r(r_), c(r_.GetCigar()), nc(c.size()), k(0), sk(0), q(0),
+                                              sx(r_.Position()), track(r_.Position()), shift(0), hit(false), has_seq(false)
+    {
+        if (nc && IsRef(c[0].Type())) track += c[0].Length();
+    }
 
-        for (size_t i = 0; i < pv.size(); ++i) { snps.push_back('.'); }
+    /* '0', '1' or '.' like GetSnpCode, or 0 if the read has a deletion or a
+     * reference skip at the site and the next read should be asked */
+    char Code(const PosInfo& s)
+    {
+        const int32_t pos = s.pos;
+        // sk: the operation holding pos, sx: the reference coordinate of its end
+        while ((!hit || pos > sx) && k < nc) {
+            char op = c[k].Type();
+            if (op == 'H' || op == 'I') { ++k; continue; }
+            sx += c[k].Length(); sk = k++; hit = true;
+        }
+        if (!hit || pos > sx) return '.';
+        if (sx == pos && sk + 1 < nc) { // an indel right after the site
+            char op2 = c[sk+1].Type();
+            if ((op2 == 'D' || op2 == 'I') && c[sk+1].Length() != 0) return '.';
+        }
+        char op = c[sk].Type();
+        if (op == 'D' || op == 'N') return 0;
 
-    } else {
+        // same offset as GetOffset
+        while (q < nc && track < (uint32_t)pos) {
+            switch (c[q].Type()) {
+            case 'I': case 'S': shift += c[q].Length(); break;
+            case 'D': case 'P': case 'N': shift -= c[q].Length(); break;
+            default : break;
+            }
+            if (++q < nc && IsRef(c[q].Type())) track += c[q].Length();
+        }
+        uint32_t offset = (uint32_t)pos - (r.Position() + 1) + shift;
+        if (!has_seq) { seq = r.Sequence(); has_seq = true; }
+        if (offset > seq.length() - 1) {
+            throw std::out_of_range("index offset " + BaseVarC::tostring(offset) + " is out of range of the sequence " + seq + " of " + r.Qname() + " read");
+        }
+        char x = seq[offset];
+        if (x == s.ref) {
+            return '0';
+        } else if (x == s.alt) {
+            return '1';
+        } else {
+            return '.';
+        }
+    }
 
-        size_t i = 0, j = 0, k = 0, nc, sk;
-        int32_t sx, sy, indel, pos;
-        bool eof = false, next = false, is_indel = false, is_del = false, is_refskip = false;
-        std::string indel_str;
-        SeqLib::Cigar c;
-        SeqLib::BamRecord r;
-        r = rv[i];
-        // const std::string SKIP = "DPN";
-        for (auto const& s: pv) {
-            /* select the first record covering this position */
-            pos = s.pos;
-            if (pos < r.Position() + 1) { // make 1-based
-                snps.push_back('.');
-            } else {
-                // r.PositionEnd is 1-based
-                while (pos > r.PositionEnd()) {
-                    if (i == rv.size() - 1) {eof = true; break;}
-                    r = rv[++i]; j = i;
-                    if (s.pos < r.Position() + 1) { next = true; break;}
-                }
-                if (next || eof) {
-                    snps.push_back('.');
-                    eof = false; next = false; continue;
-                }
-                // find proper read here
-                while (true) {
-                    c = r.GetCigar(); nc = c.size();
-                    for (k = 0, sx = r.Position(), sy = 0; k < nc; ++k) {
-                        char op = c[k].Type();
-                        int l = c[k].Length();
-                        if (op == 'M' || op == 'I' || op == 'S' || op == 'X') sy += l;
-                        if (op == 'H' || op == 'I') continue;
-                        else sx += l;
-                        if (pos <= sx) break;
-                    }
-                    assert(k < nc);
-                    sk = k;
-                    // collect indel information
-                    is_indel = is_del = is_refskip = false; indel = 0;
-                    {
-                        char op = c[sk].Type();
-                        if (sx == pos && sk + 1 < nc) { //peek the next operation
-                            char op2 = c[sk+1].Type();
-                            int l2 = c[sk+1].Length();
-                            if (op2 == 'D') indel = -(int)l2, indel_str = "-" + refseq.substr(pos - rg_s + 1, l2);  // start from the next operation position
-                            else if (op2 == 'I') indel = l2, indel_str = "+" + r.Sequence().substr(sy, l2);
-                            else if (op2 == 'P' && sk + 2 < nc) { // no working for adjacent padding
-                                indel_str = 'N';   // this indicates the indel may be adjacent with a padding operation
-                                int l3 = 0;
-                                for (k = sk + 2; k < nc; ++k) {
-                                    op2 = c[sk].Type();
-                                    l2 = c[sk].Length();
-                                    if (op2 == 'I') l3 += l2;
-                                    else if (op2 == 'D' || op2 == 'M' || op2 == 'N' || op2 == 'X') break;
-                                }
-                                if (l3 > 0) indel = l3;
-                            }
-                        }
-                        if (indel != 0) is_indel = true;
-                        if (op == 'D') is_del = true;
-                        else if (op == 'N') is_refskip = true;
-                    }
-                    // here we go
-                    if (is_indel) {
-                        snps.push_back('.');
-                        break;
-                    }
+private:
+    static bool IsRef(char t) { return t != 'I' && t != 'S' && t != 'H'; }
 
-                    if (!is_del && !is_refskip) {
-                        snps.push_back(GetSnpCode(r, s));
-                        break;
-                    } else if (j < rv.size() - 1) {
-                        r = rv[++j];
-                        if (pos < r.Position() + 1 || pos > r.PositionEnd()) {
-                            snps.push_back('.');
-                            break;
-                        }
-                    } else {
-                        snps.push_back('.');
-                        break;
-                    }
-                }
+    const SeqLib::BamRecord& r;
+    const SeqLib::Cigar c;
+    const size_t nc;
+    size_t k, sk, q;
+    int32_t sx;
+    uint32_t track, shift;
+    bool hit, has_seq;
+    std::string seq;
+};
+
+}
 
-                r = rv[i]; j = i;     // all back to index i
+// indels are typed as '.', so no reference is needed
+std::string BamProcess::FetchAlleleType(const std::string& rg, const PosInfoVector& pv)
+{
+    SeqLib::BamRecordVector rv;
+    std::string snps(pv.size(), '.');
+    if (!GetBRV(rg, rv)) return snps;
+
+    /* Driven by the reads instead of the sites: a site is typed from the first
+     * read ending at or after it, so read i owns the sites in (E, end_i], E is
+     * the furthest end of the reads before it. Those are found by galloping over
+     * the sorted sites and typed with one forward walk of the CIGAR, the cost
+     * scales with the reads and the covered sites rather than with pv. */
+    assert(std::is_sorted(pv.begin(), pv.end(), [](const PosInfo& a, const PosInfo& b) { return a.pos < b.pos; }));
+    size_t s = 0;
+    int32_t E = std::numeric_limits<int32_t>::min();
+    for (size_t i = 0; i < rv.size() && s < pv.size(); ++i) {
+        const SeqLib::BamRecord& r = rv[i];
+        int32_t end = r.PositionEnd();  // 1-based
+        if (end <= E) continue;
+        E = end;
+        size_t t = GallopSite(pv, s, end);
+        s = std::min(GallopSite(pv, s, r.Position()), t);   // sites before the read start stay '.'
+        if (s == t) continue;
+
+        CigarCursor cur(r);
+        for (; s < t; ++s) {
+            char x = cur.Code(pv[s]);
+            // deletion or reference skip, ask the following reads covering the site
+            for (size_t j = i + 1; x == 0; ++j) {
+                if (j == rv.size() || pv[s].pos < rv[j].Position() + 1 || pv[s].pos > rv[j].PositionEnd()) {
+                    x = '.';
+                } else {
+                    CigarCursor next(rv[j]);
+                    x = next.Code(pv[s]);
+                }
             }
+            snps[s] = x;
         }
     }
 
-    std::string out(snps.begin(), snps.end());
-    return out;
+    return snps;
 }
 
 char BamProcess::GetSnpCode(const SeqLib::BamRecord& r, const PosInfo& s) const
@@ -263,26 +294,29 @@ int BamProcess::GetOffset(const SeqLib::BamRecord& r, const uint32_t pos) const
 
 bool BamProcess::GetBRV(const std::string& rg, SeqLib::BamRecordVector& rv)
 {
-    // check if the BAM is sorted
-    std::string hh = Header().AsString(); //std::string(header()->text)
-    bool sorted = hh.find("SO:coord") != std::string::npos;
-    if (!sorted) {
-        throw std::runtime_error("ERROR: BAM file does not appear to be sorted (no SO:coordinate) found in header.\n       Sorted BAMs are required.");
-    }
-    // find sm:samplename
-    size_t p;
-    if ((p = hh.find("SM:")) != std::string::npos) {
-        hh.erase(0, p+3);
-        if ((p = hh.find("\n")) != std::string::npos) {
-            hh.erase(hh.begin() + p, hh.end());
-            if ((p = hh.find("\t")) != std::string::npos) {
-                sm = hh.substr(0, p);
-            } else {
-                sm = hh;
+    // the header is checked once, popmatrix calls this for many regions
+    if (sm.empty()) {
+        // check if the BAM is sorted
+        std::string hh = Header().AsString(); //std::string(header()->text)
+        bool sorted = hh.find("SO:coord") != std::string::npos;
+        if (!sorted) {
+            throw std::runtime_error("ERROR: BAM file does not appear to be sorted (no SO:coordinate) found in header.\n       Sorted BAMs are required.");
+        }
+        // find sm:samplename
+        size_t p;
+        if ((p = hh.find("SM:")) != std::string::npos) {
+            hh.erase(0, p+3);
+            if ((p = hh.find("\n")) != std::string::npos) {
+                hh.erase(hh.begin() + p, hh.end());
+                if ((p = hh.find("\t")) != std::string::npos) {
+                    sm = hh.substr(0, p);
+                } else {
+                    sm = hh;
+                }
             }
+        } else {
+            throw std::runtime_error("ERROR: No SM tag can be found. Please make sure there is SM tag in the bam header");
         }
-    } else {
-        throw std::runtime_error("ERROR: No SM tag can be found. Please make sure there is SM tag in the bam header");
     }
     SeqLib::GenomicRegion gr(rg, Header());
     gr.Pad(1000);
@@ -53,7 +53,7 @@ class BamProcess: public SeqLib::BamReader
 
     bool FindSnpAtPos(int32_t rg_s, const std::string& refseq, const std::string& rg, const std::vector<int32_t>& pv);
 
-    std::string FetchAlleleType(int32_t rg_s, const std::string& refseq, const std::string& rg, const PosInfoVector& pv);
+    std::string FetchAlleleType(const std::string& rg, const PosInfoVector& pv);
 
     std::string sm;
 
@@ -2,11 +2,46 @@
 #define FMT_HEADER_ONLY
 #include "fmt/format.h"
 
-BaseType::BaseType(BaseV bases_, BaseV quals_, int8_t ref, double minaf) : bases(bases_), quals(quals_), ref_base(ref), min_af(minaf), nind(bases.size()), ind_allele_likelihood(nind * NTYPE), init_allele_freq(NTYPE)
+BaseType::BaseType(BaseV bases_, BaseV quals_, int8_t ref, double minaf) : bases(bases_), quals(quals_), ref_base(ref), min_af(minaf), nind(bases.size()), init_allele_freq(NTYPE)
 {
     var_qual = 0;
     depth_total = 0;
-    depth = { {0, 0},{1, 0},{2, 0},{3, 0} };
+    em_iter = 0;
+    std::fill(depth, depth + NTYPE, 0);
+    for (int32_t i = 0; i < nind; ++i) {
+        depth[bases[i]] += 1;
+    }
+    for (int b = 0; b < NTYPE; ++b) {
+        depth_total += depth[b];
+    }
+}
+
+BaseType::BaseType(BaseType& parent_, const std::vector<int32_t>& rows_) : parent(&parent_), rows(&rows_), ref_base(parent_.ref_base), min_af(parent_.min_af), nind(rows_.size()), init_allele_freq(NTYPE)
+{
+    var_qual = 0;
+    depth_total = 0;
+    em_iter = 0;
+    std::fill(depth, depth + NTYPE, 0);
+    for (int32_t i = 0; i < nind; ++i) {
+        depth[Base(i)] += 1;
+    }
+    for (int b = 0; b < NTYPE; ++b) {
+        depth_total += depth[b];
+    }
+}
+
+void BaseType::SetLikelihood()
+{
+    // only built when LRT really runs, a cache hit never needs it
+    if (ind_allele_likelihood.size() == static_cast<size_t>(nind * NTYPE)) return;
+    ind_allele_likelihood.resize(nind * NTYPE);
+    if (parent) {
+        parent->SetLikelihood();
+        for (int32_t i = 0; i < nind; ++i) {
+            std::copy_n(parent->ind_allele_likelihood.begin() + (*rows)[i] * NTYPE, NTYPE, ind_allele_likelihood.begin() + i * NTYPE);
+        }
+        return;
+    }
     for (int32_t i = 0; i < nind; ++i) {
         for (int j = 0; j < NTYPE; ++j) {
             if (bases[i] == BASE[j]) {
@@ -15,83 +50,81 @@ BaseType::BaseType(BaseV bases_, BaseV quals_, int8_t ref, double minaf) : bases
                 ind_allele_likelihood[i * NTYPE + j] = exp(MLN10TO10 * quals[i]) / 3.0;
             }
         }
-        depth[bases[i]] += 1;
-    }
-    for (DepM::iterator it = depth.begin(); it != depth.end(); ++it) {
-        depth_total += it->second;
     }
 }
 
-void BaseType::SetAlleleFreq(const BaseV& bases)
+bool BaseType::SetAlleleFreq(const BaseV& bases, const ProbV& warm_frq)
 {
     int32_t depth_sum = 0;
+    double warm_sum = 0;
     for (auto b : bases) {
         depth_sum += depth[b];
+        if (!warm_frq.empty()) warm_sum += warm_frq[b];
     }
     for (int j = 0; j < NTYPE; ++j) {
         init_allele_freq[j] = 0;
     }
-    if (depth_sum > 0) {
+    if (depth_sum > 0 && warm_sum > 0) {
+        // warm start from the solution of the enclosing hypothesis
+        for (auto b : bases) {
+            init_allele_freq[b] = warm_frq[b] / warm_sum;
+        }
+    } else if (depth_sum > 0) {
         for (auto b : bases) {
             init_allele_freq[b] = static_cast<double>(depth[b]) / depth_sum;
         }
     }
+    return depth_sum > 0;
 }
 
-void BaseType::UpdateF(const BaseV& bases, CombV& bc, ProbV& lr, FreqV& bp, int32_t k)
+double BaseType::RunEM(const BaseV& cols, ProbV& marginal_likelihood, ProbV& expect_allele_prob)
+{
+    // init_allele_freq must be set already
+    double likelihood_sum = 0;
+    em_iter += EM(init_allele_freq, ind_allele_likelihood, marginal_likelihood, expect_allele_prob, cols.data(), cols.size(), nind, NTYPE, EM_ITER, EM_EPSILON);
+    for (int32_t i = 0; i < nind; ++i) {
+        likelihood_sum += std::log(marginal_likelihood[i]);
+    }
+    return likelihood_sum;
+}
+
+void BaseType::UpdateF(const CombV& bc, const ProbV& warm_frq, ProbV& lr, FreqV& bp)
 {
     ProbV marginal_likelihood(nind), expect_allele_prob(NTYPE);
-    double freq_sum, likelihood_sum;
-    double epsilon = 0.001;
-    int iter_num = 100;
-    ProbV expect_prob;
-    bc.clear(); lr.clear(); bp.clear();
-    combs_(bases, bc, k);
+    lr.clear(); bp.clear();
     for (auto const& b: bc) {
-        SetAlleleFreq(b);
-        freq_sum = 0;
-        for (int i = 0; i < NTYPE; ++i) freq_sum += init_allele_freq[i];
-        if (freq_sum == 0) continue;  // skip coverage = 0, this may be redundant but it's ok;
+        if (!SetAlleleFreq(b, warm_frq)) continue;  // skip coverage = 0, this may be redundant but it's ok;
         // run EM
-        EM(init_allele_freq, ind_allele_likelihood, marginal_likelihood, expect_allele_prob, nind, NTYPE, iter_num, epsilon);
-        likelihood_sum = 0;
-        for (int32_t i = 0; i < nind; ++i) {
-            likelihood_sum += std::log(marginal_likelihood[i]);
-            // reset array elements to 0
-            marginal_likelihood[i] = 0;
-        }
-        expect_prob.clear();
-        for (int i = 0; i < NTYPE; ++i) {
-            expect_prob.push_back(expect_allele_prob[i]);
-            expect_allele_prob[i] = 0;
-        }
-        lr.push_back(likelihood_sum);
-        bp.push_back(expect_prob);
+        lr.push_back(RunEM(b, marginal_likelihood, expect_allele_prob));
+        bp.push_back(expect_allele_prob);
     }
 }
 
 bool BaseType::LRT()
 {
     if (depth_total == 0) return false;
-    bases.clear();
+    SetLikelihood();
+    BaseV lrt_bases;
     for (auto b : base_comb) {
         // filter bases by count freqence >= min_af
         if ((depth[b]/depth_total) >= min_af) {
-            bases.push_back(b);
+            lrt_bases.push_back(b);
         }
     }
-    int32_t n = bases.size();
+    int32_t n = lrt_bases.size();
     if (n == 0) return false;
     CombV bc;
     FreqV bp;
     ProbV lr_null, lrt_chi;
-    UpdateF(bases, bc, lr_null, bp, n);
+    combs_(lrt_bases, bc, n);
+    UpdateF(bc, ProbV(), lr_null, bp);
     ProbV base_frq = bp[0];
     double lr_alt_t = lr_null[0];
     double chi_sqrt_t = 0.0;
     size_t i_min;
     for (int32_t k = n - 1; k > 0; --k) {
-        UpdateF(bases, bc, lr_null, bp, k);
+        combs_(lrt_bases, bc, k);
+        UpdateF(bc, base_frq, lr_null, bp);
         lrt_chi.clear();
         for (auto & lr_null_t: lr_null) {
             lrt_chi.push_back(2.0 * (lr_alt_t - lr_null_t));
@@ -101,14 +134,14 @@ bool BaseType::LRT()
         chi_sqrt_t = lrt_chi[i_min];
         if (chi_sqrt_t < LRT_THRESHOLD) {
             // Take the null hypothesis and continue
-            bases = bc[i_min];
+            lrt_bases = bc[i_min];
             base_frq = bp[i_min];
         } else {
             // Take the alternate hypothesis
             break;
         }
     }
-    for (auto b: bases) {
+    for (auto b: lrt_bases) {
         if (b != ref_base) {
             alt_bases.push_back(b);
             af_lrt.insert({b, base_frq[b]});
@@ -116,8 +149,8 @@ bool BaseType::LRT()
     }
     double r, chi_prob;
     if (alt_bases.size() > 0) {
-        r = depth[bases[0]] / depth_total;
-        if (bases.size() == 1 && depth_total > 10 && r > 0.5) {
+        r = depth[lrt_bases[0]] / depth_total;
+        if (lrt_bases.size() == 1 && depth_total > 10 && r > 0.5) {
             var_qual = 5000.0;  // mono-allelelic
         } else {
             if (chi_sqrt_t <= 0) {
@@ -138,118 +171,266 @@ bool BaseType::LRT()
     }
 }
 
-String WriteVcf(const BaseType& bt, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const DepM& idx, InfoM& info, int32_t N)
+
+void LrtCache::Key(const BaseType& bt, String& k)
 {
-    robin_hood::unordered_map<uint8_t, String> alt_gt;
-    String gt, samgt;
-    for (size_t i = 0; i < bt.alt_bases.size(); ++i) {
-        gt = fmt::format("./{}", i+1);
-        alt_gt.insert({bt.alt_bases[i], gt});
+    // canonical signature: ref, candidate bases, min_af and the sorted
+    // (base, qual) histogram of the pileup. the order of samples is irrelevant
+    int32_t i;
+    uint16_t bq;
+    touched.clear();
+    for (i = 0; i < bt.nind; ++i) {
+        bq = static_cast<uint16_t>((bt.Base(i) & 0x3) << 8 | static_cast<uint8_t>(bt.Qual(i)));
+        if (hist[bq]++ == 0) touched.push_back(bq);
     }
-    Stat st;
-    ProbV ref_quals, ref_mapqs, ref_rprs;
-    ProbV alt_quals, alt_mapqs, alt_rprs;
-    for (int32_t i = 0; i < N; ++i) {
-        if (idx.count(i) == 0) {
-            samgt += "./.\t";
-        } else {
-            auto const& a = aiv[idx.at(i)];
-            if (alt_gt.count(a.base) == 0) alt_gt.insert({a.base, "./."});
-            if (a.base == ref_base) {
-                gt = "0/.";
-            } else {
-                gt = alt_gt[a.base];
-            }
-            samgt += fmt::format("{}:{}:{}:{:.6f}\t", gt, BASE2CHAR[a.base], STRAND[a.strand], 1 - exp(MLN10TO10 * a.qual));
-            if (a.is_indel == 1 || a.base == 4) continue;
-            if (a.base == ref_base) {
-                ref_quals.push_back(a.qual);
-                ref_mapqs.push_back(a.mapq);
-                ref_rprs.push_back(a.rpr);
-            } else if (std::find(bt.alt_bases.begin(), bt.alt_bases.end(), a.base) != bt.alt_bases.end()) {
-                alt_quals.push_back(a.qual);
-                alt_mapqs.push_back(a.mapq);
-                alt_rprs.push_back(a.rpr);
-            }
-            if (a.strand == 1) {
-                if (a.base == ref_base) {
-                    st.ref_fwd += 1;
-                } else if (std::find(bt.alt_bases.begin(), bt.alt_bases.end(), a.base) != bt.alt_bases.end()) {
-                    st.alt_fwd += 1;
-                }
-            } else if (a.strand == 0) {
-                if (a.base == ref_base) {
-                    st.ref_rev += 1;
-                } else if (std::find(bt.alt_bases.begin(), bt.alt_bases.end(), a.base) != bt.alt_bases.end()) {
-                    st.alt_rev += 1;
-                }
-            }
-        }
+    std::sort(touched.begin(), touched.end());
+    k.clear();
+    k.push_back(static_cast<char>(bt.ref_base));
+    k.append(reinterpret_cast<const char*>(&bt.min_af), sizeof(bt.min_af));
+    k.push_back(static_cast<char>(bt.base_comb.size()));
+    k.append(reinterpret_cast<const char*>(bt.base_comb.data()), bt.base_comb.size());
+    for (auto b : touched) {
+        k.append(reinterpret_cast<const char*>(&b), sizeof(b));
+        k.append(reinterpret_cast<const char*>(&hist[b]), sizeof(hist[b]));
+        hist[b] = 0;
     }
-    st.phred_mapq = RankSumTest(ref_mapqs, alt_mapqs);
-    st.phred_qual = RankSumTest(ref_quals, alt_quals);
-    st.phred_rpr = RankSumTest(ref_rprs, alt_rprs);
-    st.fs = bt_fisher_exact(st.ref_fwd, st.ref_rev, st.alt_fwd, st.alt_rev);
+}
+
+bool LrtCache::LRT(BaseType& bt)
+{
+    if (max_size == 0) return bt.LRT();
+    Key(bt, key);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+        hits++;
+        auto const& r = it->second;
+        bt.var_qual = r.var_qual;
+        bt.alt_bases = r.alt_bases;
+        bt.af_lrt = r.af_lrt;
+        return r.success;
+    }
+    misses++;
+    LrtRes r;
+    r.success = bt.LRT();
+    r.var_qual = bt.var_qual;
+    r.alt_bases = bt.alt_bases;
+    r.af_lrt = bt.af_lrt;
+    if (cache.size() >= max_size) {
+        // keep memory bounded, simply start over
+        cache.clear();
+        flushes++;
+    }
+    cache.insert({key, r});
+
+    return r.success;
+}
+
+void StrandBias(Stat& st, FisherCache& fisher)
+{
+    st.fs = fisher.FS(st.ref_fwd, st.ref_rev, st.alt_fwd, st.alt_rev);
     if (st.alt_fwd * st.ref_rev > 0) {
         st.sor = static_cast<double>(st.ref_fwd * st.alt_rev) / (st.ref_rev * st.alt_fwd);
     } else {
         st.sor = 10000.0;
     }
-    double ad_sum = 0;
-    String ac, af, caf, alt;
-    for (auto b : bt.alt_bases) {
-        ad_sum += bt.depth.at(b);
-        alt += fmt::format("{},", BASE2CHAR[b]);
-        ac += fmt::format("{},", bt.depth.at(b));
-        af += fmt::format("{:.6f},", bt.af_lrt.at(b));
-        caf += fmt::format("{:.6f},", bt.depth.at(b) / bt.depth_total);
-    }
-    alt.pop_back(); samgt.pop_back();
-    ac.pop_back(); info.insert({"CM_AC", ac});
-    af.pop_back(); info.insert({"CM_AF", af});
-    caf.pop_back(); info.insert({"CM_CAF", caf});
-    info.insert({"QD", fmt::format("{:.3f}", bt.var_qual/ad_sum)});
-    info.insert({"CM_DP", fmt::format("{:.0f}", bt.depth_total)});
-    info.insert({"MQRankSum", fmt::format("{:.3f}", st.phred_mapq)});
-    info.insert({"ReadPosRankSum", fmt::format("{:.3f}", st.phred_rpr)});
-    info.insert({"BaseQRankSum", fmt::format("{:.3f}", st.phred_qual)});
-    info.insert({"FS", fmt::format("{:.3f}", st.fs)});
-    info.insert({"SOR", fmt::format("{:.3f}", st.sor)});
-    info.insert({"SB_REF", fmt::format("{},{}", st.ref_fwd, st.ref_rev)});
-    info.insert({"SB_ALT", fmt::format("{},{}", st.alt_fwd, st.alt_rev)});
-    String qt;
-    if (bt.var_qual > QUAL_THRESHOLD) {
-        qt = ".";
+}
+
+static const Stat& siteStat(SiteSum& sum, FisherCache& fisher)
+{
+    // strand counts and rank-sum histograms come from bt_sum
+    Stat& st = sum.st;
+    st.phred_mapq = RankSumTest(sum.ref_mapqs, sum.alt_mapqs);
+    st.phred_qual = RankSumTest(sum.ref_quals, sum.alt_quals);
+    st.phred_rpr = RankSumTest(sum.ref_rprs, sum.alt_rprs);
+    // usually the same table as the cvg one of bt_f, reuse it then
+    const Stat& sb = sum.sb;
+    if (st.ref_fwd == sb.ref_fwd && st.ref_rev == sb.ref_rev && st.alt_fwd == sb.alt_fwd && st.alt_rev == sb.alt_rev) {
+        st.fs = sb.fs;
+        st.sor = sb.sor;
     } else {
-        qt = "LowQual";
+        StrandBias(st, fisher);
     }
-    String out = fmt::format("{}\t{}\t.\t{}\t{}\t{:.2f}\t{}\t", chr, pos, BASE2CHAR[ref_base], alt, bt.var_qual, qt);
-    for (InfoM::iterator it = info.begin(); it != info.end(); ++it) {
-        out += it->first + "=" + it->second + ";";
+    return st;
+}
+
+// INFO keys of WriteVcf in the order they are written
+static const char* INFO_KEYS[] = {"BaseQRankSum", "CM_AC", "CM_AF", "CM_CAF", "CM_DP", "FS", "MQRankSum", "QD", "ReadPosRankSum", "SB_ALT", "SB_REF", "SOR"};
+
+std::vector<int32_t> VcfInfoOrder(const std::vector<String>& groups)
+{
+    // sorted by key as records always had them, the <group>_AF keys merged in
+    std::vector<std::pair<String, int32_t>> keys;
+    for (int32_t i = 0; i < 12; ++i) keys.push_back({INFO_KEYS[i], -1 - i});
+    for (size_t g = 0; g < groups.size(); ++g) keys.push_back({groups[g] + "_AF", (int32_t)g});
+    std::stable_sort(keys.begin(), keys.end(), [](const std::pair<String, int32_t>& a, const std::pair<String, int32_t>& b) {return a.first < b.first;});
+    std::vector<int32_t> order;
+    for (auto & k : keys) order.push_back(k.second);
+    return order;
+}
+
+void SampleColumns(String& out, const BaseV& alt_bases, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, int32_t N)
+{
+    // genotype of each base value, "./." unless ref or a called alt
+    char alt_gt[8][3];
+    for (auto & gt : alt_gt) memcpy(gt, "./.", 3);
+    for (size_t i = 0; i < alt_bases.size(); ++i) {
+        alt_gt[alt_bases[i]][2] = '1' + i;
+    }
+    if (ref_base >= 0) memcpy(alt_gt[ref_base], "0/.", 3);
+    auto it = std::back_inserter(out);
+    // sam is sorted and parallel to aiv, merge it against 0..N
+    size_t k = 0;
+    for (int32_t i = 0; i < N; ++i) {
+        if (i > 0) out += '\t';
+        if (k == sam.size() || sam[k] != i) {
+            out.append("./.", 3);
+        } else {
+            auto const& a = aiv[k++];
+            out.append(alt_gt[a.base], 3);
+            fmt::format_to(it, ":{}:{}:{:.6f}", BASE2CHAR[a.base], STRAND[a.strand], 1 - exp(MLN10TO10 * a.qual));
+        }
     }
-    out.pop_back();
-    out += "\tGT:AB:SO:BP\t" + samgt + "\n";
+}
 
-    return out;
+void WriteVcf(String& out, const BaseType& bt, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, const std::vector<int32_t>& info_order, const std::vector<String>& groups, int32_t N, SiteSum& sum, FisherCache& fisher)
+{
+    const Stat& st = siteStat(sum, fisher);
+    double ad_sum = 0;
+    for (auto b : bt.alt_bases) ad_sum += bt.depth[b];
+    // the record is appended field by field, out keeps its capacity between sites
+    auto it = std::back_inserter(out);
+    fmt::format_to(it, "{}\t{}\t.\t{}\t", chr, pos, BASE2CHAR[ref_base]);
+    for (size_t i = 0; i < bt.alt_bases.size(); ++i) {
+        if (i > 0) out += ',';
+        out += BASE2CHAR[bt.alt_bases[i]];
+    }
+    fmt::format_to(it, "\t{:.2f}\t{}\t", bt.var_qual, bt.var_qual > QUAL_THRESHOLD ? "." : "LowQual");
+    bool first = true;
+    for (auto o : info_order) {
+        if (!first) out += ';';
+        first = false;
+        if (o >= 0) {
+            fmt::format_to(it, "{}_AF={}", groups[o], sum.gr_str[o]);
+            continue;
+        }
+        out += INFO_KEYS[-1 - o];
+        out += '=';
+        switch (-1 - o) {
+        case 0: fmt::format_to(it, "{:.3f}", st.phred_qual); break;
+        case 1: case 2: case 3:
+            for (size_t i = 0; i < bt.alt_bases.size(); ++i) {
+                const int8_t b = bt.alt_bases[i];
+                if (i > 0) out += ',';
+                if (o == -2) fmt::format_to(it, "{}", bt.depth[b]);
+                else if (o == -3) fmt::format_to(it, "{:.6f}", bt.af_lrt.at(b));
+                else fmt::format_to(it, "{:.6f}", bt.depth[b] / bt.depth_total);
+            }
+            break;
+        case 4: fmt::format_to(it, "{:.0f}", bt.depth_total); break;
+        case 5: fmt::format_to(it, "{:.3f}", st.fs); break;
+        case 6: fmt::format_to(it, "{:.3f}", st.phred_mapq); break;
+        case 7: fmt::format_to(it, "{:.3f}", bt.var_qual/ad_sum); break;
+        case 8: fmt::format_to(it, "{:.3f}", st.phred_rpr); break;
+        case 9: fmt::format_to(it, "{},{}", st.alt_fwd, st.alt_rev); break;
+        case 10: fmt::format_to(it, "{},{}", st.ref_fwd, st.ref_rev); break;
+        case 11: fmt::format_to(it, "{:.3f}", st.sor); break;
+        }
+    }
+    if (N > 0) {
+        out += "\tGT:AB:SO:BP\t";
+        SampleColumns(out, bt.alt_bases, ref_base, aiv, sam, N);
+    }
+    out += '\n';
 }
 
 
+void WriteBcf(const BaseType& bt, bcf_hdr_t* hdr, bcf1_t* rec, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, const std::vector<String>& groups, int32_t N, SiteSum& sum, FisherCache& fisher)
+{
+    bcf_clear(rec);
+    rec->rid = bcf_hdr_name2id(hdr, chr.c_str());
+    if (rec->rid < 0) {
+        throw std::runtime_error("ERROR: " + chr + " is not a contig of the header, check the .fai of the reference");
+    }
+    rec->pos = pos - 1;
+    rec->qual = bt.var_qual;
+    String alleles(1, BASE2CHAR[ref_base]);
+    for (auto b : bt.alt_bases) {
+        alleles += ',';
+        alleles += BASE2CHAR[b];
+    }
+    bcf_update_alleles_str(hdr, rec, alleles.c_str());
+    if (bt.var_qual <= QUAL_THRESHOLD) {
+        int32_t flt = bcf_hdr_id2int(hdr, BCF_DT_ID, "LowQual");
+        bcf_update_filter(hdr, rec, &flt, 1);
+    }
+    // INFO, typed as declared in VCF_HEADER
+    const Stat& st = siteStat(sum, fisher);
+    std::vector<int32_t> ac;
+    std::vector<float> af, caf;
+    double ad_sum = 0;
+    for (auto b : bt.alt_bases) {
+        ad_sum += bt.depth[b];
+        ac.push_back(bt.depth[b]);
+        af.push_back(bt.af_lrt.at(b));
+        caf.push_back(bt.depth[b] / bt.depth_total);
+    }
+    float v;
+    int32_t iv[2];
+    v = st.phred_qual; bcf_update_info_float(hdr, rec, "BaseQRankSum", &v, 1);
+    bcf_update_info_int32(hdr, rec, "CM_AC", ac.data(), ac.size());
+    bcf_update_info_float(hdr, rec, "CM_AF", af.data(), af.size());
+    bcf_update_info_float(hdr, rec, "CM_CAF", caf.data(), caf.size());
+    iv[0] = bt.depth_total; bcf_update_info_int32(hdr, rec, "CM_DP", iv, 1);
+    v = st.fs; bcf_update_info_float(hdr, rec, "FS", &v, 1);
+    v = st.phred_mapq; bcf_update_info_float(hdr, rec, "MQRankSum", &v, 1);
+    v = bt.var_qual/ad_sum; bcf_update_info_float(hdr, rec, "QD", &v, 1);
+    v = st.phred_rpr; bcf_update_info_float(hdr, rec, "ReadPosRankSum", &v, 1);
+    iv[0] = st.alt_fwd; iv[1] = st.alt_rev; bcf_update_info_int32(hdr, rec, "SB_ALT", iv, 2);
+    iv[0] = st.ref_fwd; iv[1] = st.ref_rev; bcf_update_info_int32(hdr, rec, "SB_REF", iv, 2);
+    v = st.sor; bcf_update_info_float(hdr, rec, "SOR", &v, 1);
+    for (size_t g = 0; g < groups.size(); ++g) {
+        bcf_update_info_float(hdr, rec, (groups[g] + "_AF").c_str(), sum.gr_af[g].data(), sum.gr_af[g].size());
+    }
+    if (N == 0) return;    // sites only
+    // FORMAT GT:AB:SO:BP, allele index of each base value, -1 unless ref or a called alt
+    int32_t allele[8];
+    std::fill(allele, allele + 8, -1);
+    for (size_t i = 0; i < bt.alt_bases.size(); ++i) allele[bt.alt_bases[i]] = i + 1;
+    if (ref_base >= 0) allele[ref_base] = 0;
+    sum.gt.assign(2 * N, bcf_gt_missing);
+    sum.ab.assign(N, '.');
+    sum.so.assign(N, '.');
+    sum.bp.resize(N);
+    size_t k = 0;
+    for (int32_t i = 0; i < N; ++i) {
+        if (k == sam.size() || sam[k] != i) {
+            bcf_float_set_missing(sum.bp[i]);
+            continue;
+        }
+        auto const& a = aiv[k++];
+        if (allele[a.base] == 0) sum.gt[2 * i] = bcf_gt_unphased(0);
+        else if (allele[a.base] > 0) sum.gt[2 * i + 1] = bcf_gt_unphased(allele[a.base]);
+        if (a.base < 4) sum.ab[i] = BASE2CHAR[a.base];
+        sum.so[i] = STRAND[a.strand];
+        sum.bp[i] = 1 - exp(MLN10TO10 * a.qual);
+    }
+    bcf_update_genotypes(hdr, rec, sum.gt.data(), 2 * N);
+    bcf_update_format_char(hdr, rec, "AB", sum.ab.data(), N);
+    bcf_update_format_char(hdr, rec, "SO", sum.so.data(), N);
+    bcf_update_format_float(hdr, rec, "BP", sum.bp.data(), N);
+}
+
 void combs_(const BaseV& bases, CombV& comb_v, int32_t k)
 {
-    // k <= n
+    // k <= n <= NTYPE
     int32_t n = bases.size();
-    std::string bitmask(k, 1); // K leading 1's
-    bitmask.resize(n, 0); // N-K trailing 0's
-
-    BaseV bv;
-    comb_v.clear();
-    bv.reserve(k);
-    do {
-        for (int32_t i = 0; i < n; ++i) // [0..N-1] integers
-        {
-            if (bitmask[i]) bv.push_back(bases[i]);
-        }
-        comb_v.push_back(bv);
+    int32_t c, i;
+    comb_v.resize(COMB_NUM[n][k]);
+    for (c = 0; c < COMB_NUM[n][k]; ++c) {
+        BaseV& bv = comb_v[c];
         bv.clear();
-    } while (std::prev_permutation(bitmask.begin(), bitmask.end()));
+        for (i = 0; i < n; ++i) {
+            if (COMB_MASK[n][k][c] >> i & 1) bv.push_back(bases[i]);
+        }
+    }
 }
@@ -5,20 +5,22 @@
 #include "Algorithm.h"
 #include "BamProcess.h"
 #include "robin_hood.h"
+#include "htslib/vcf.h"
 
 #define LRT_THRESHOLD 24.0    // chi-pvalue of 10^-6
 #define MLN10TO10 -0.23025850929940458    // -log(10)/10
 #define MINAF 0.001                       // base freqence threshold
 #define QUAL_THRESHOLD 60   // -10 * lg(10^-6)
-#define NTYPE 4
+#define EM_ITER 100         // max EM steps of each hypothesis
+#define EM_EPSILON 1e-6     // converged when allele frequencies change less
+#define NTYPE NTYPE_MAX
 
 typedef std::string String;
 typedef std::vector<double> ProbV;
 typedef std::vector<ProbV> FreqV;
 typedef std::vector<int8_t> BaseV;
 typedef std::vector<BaseV> CombV;
-typedef std::map<String, String> InfoM;
-typedef robin_hood::unordered_map<int32_t, int32_t> DepM;
+typedef robin_hood::unordered_map<String, int> IndelMap;
 static const int BASE[4] = {0, 1, 2, 3};
 static const char STRAND[2] = {'-', '+'};
 static const char BASE2CHAR[4] = {'A', 'C', 'G', 'T'};
@@ -41,6 +43,23 @@ static const char BASE_INT8_TABLE[128] = {
     -1, -1, -1, -1, -1, -1, -1, -1,
 };
 
+// all combinations of k out of n (<= NTYPE) bases, stored as bitmasks over the
+// n positions and listed in the same order as std::prev_permutation gives.
+static constexpr int8_t COMB_NUM[NTYPE + 1][NTYPE + 1] = {
+    {1, 0, 0, 0, 0},
+    {1, 1, 0, 0, 0},
+    {1, 2, 1, 0, 0},
+    {1, 3, 3, 1, 0},
+    {1, 4, 6, 4, 1},
+};
+static constexpr uint8_t COMB_MASK[NTYPE + 1][NTYPE + 1][6] = {
+    {{0x0}},
+    {{0x0}, {0x1}},
+    {{0x0}, {0x1, 0x2}, {0x3}},
+    {{0x0}, {0x1, 0x2, 0x4}, {0x3, 0x5, 0x6}, {0x7}},
+    {{0x0}, {0x1, 0x2, 0x4, 0x8}, {0x3, 0x5, 0x9, 0x6, 0xa, 0xc}, {0x7, 0xb, 0xd, 0xe}, {0xf}},
+};
+
 struct Stat
 {
     double phred_qual;
@@ -54,14 +73,44 @@ struct Stat
     int alt_rev = 0;
 };
 
+// set st.fs and st.sor from the strand counts of st
+void StrandBias(Stat& st, FisherCache& fisher);
+
+/* everything the cvg and vcf writers need from the pileup of a site,
+ * filled by a single pass over it (bt_sum). kept per thread and reused */
+struct SiteSum
+{
+    int32_t depth[NTYPE];                   // A, C, G, T
+    int32_t strand[8][2];                   // [base][strand] of all entries
+    IndelMap indel_m;
+    std::vector<int32_t> gr_depth;          // [group * NTYPE + base]
+    std::vector<std::vector<int32_t>> gr_rows;  // reads of bt per group, only for called sites
+    std::vector<std::vector<float>> gr_af;      // group allele frequencies
+    std::vector<String> gr_str;                 // and their vcf INFO values
+    Stat sb;                                // cvg strand bias, ref vs top non-ref base
+    Stat st;                                // vcf stats, ref vs called alt bases
+    // rank-sum histograms of ref and alt reads, only for called sites
+    int32_t ref_quals[RANK_BINS], ref_mapqs[RANK_BINS], ref_rprs[RANK_BINS];
+    int32_t alt_quals[RANK_BINS], alt_mapqs[RANK_BINS], alt_rprs[RANK_BINS];
+    // FORMAT buffers of WriteBcf
+    std::vector<int32_t> gt;
+    String ab, so;
+    std::vector<float> bp;
+};
+
+
 void combs_(const BaseV& bases, CombV& comb_v, int32_t k);
 
 class BaseType
 {
-    friend String WriteVcf(const BaseType& bt, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const DepM& idx, InfoM& info, int32_t N);
+    friend class LrtCache;
+    friend void WriteVcf(String& out, const BaseType& bt, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, const std::vector<int32_t>& info_order, const std::vector<String>& groups, int32_t N, SiteSum& sum, FisherCache& fisher);
 
  public:
     BaseType(BaseV base, BaseV qual, int8_t ref, double minaf);
+    // view of the reads rows of parent, e.g. one population group. the
+    // likelihoods of parent are reused, parent must outlive the view
+    BaseType(BaseType& parent, const std::vector<int32_t>& rows);
     ~BaseType() {}
 
     void SetBase (const BaseV& v) { this->base_comb = v; }
@@ -69,13 +118,16 @@ class BaseType
 
     double var_qual;
     double depth_total;
+    int32_t em_iter;    // number of EM steps taken by LRT
     BaseV alt_bases;
-    DepM depth;
+    int32_t depth[NTYPE];    // A, C, G, T
     robin_hood::unordered_map<int8_t, double> af_lrt;
 
  private:
     BaseV bases;
     BaseV quals;
+    BaseType* parent = NULL;
+    const std::vector<int32_t>* rows = NULL;
     BaseV base_comb{0, 1, 2, 3};
     const int8_t ref_base;
     const double min_af;
@@ -83,10 +135,63 @@ class BaseType
     ProbV ind_allele_likelihood;
     ProbV init_allele_freq;
 
-    void SetAlleleFreq(const BaseV& bases);
+    int8_t Base(int32_t i) const { return parent ? parent->bases[(*rows)[i]] : bases[i]; }
+    int8_t Qual(int32_t i) const { return parent ? parent->quals[(*rows)[i]] : quals[i]; }
 
-    void UpdateF(const BaseV& bases, CombV& bc, ProbV& lr, FreqV& bp, int32_t k);
+    void SetLikelihood();
+
+    bool SetAlleleFreq(const BaseV& bases, const ProbV& warm_frq);
+
+    double RunEM(const BaseV& cols, ProbV& marginal_likelihood, ProbV& expect_allele_prob);
+
+    void UpdateF(const CombV& bc, const ProbV& warm_frq, ProbV& lr, FreqV& bp);
 };
 
+struct LrtRes
+{
+    bool success;
+    double var_qual;
+    BaseV alt_bases;
+    robin_hood::unordered_map<int8_t, double> af_lrt;
+};
+
+/* per-thread memo of LRT results keyed by the pileup signature.
+ * sites with the same multiset of (base, qual), ref base and candidate bases
+ * always get the same var_qual, alt_bases and af_lrt, so EM can be skipped. */
+class LrtCache
+{
+ public:
+    LrtCache(size_t size): max_size(size), hist(4 << 8, 0) {}
+    ~LrtCache() {}
+
+    // run bt.LRT() or restore its results from cache. size 0 disables caching
+    bool LRT(BaseType& bt);
+
+    double HitRate() const { return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+
+    int64_t hits = 0;
+    int64_t misses = 0;
+    int64_t flushes = 0;
+
+ private:
+    void Key(const BaseType& bt, String& k);
+
+    const size_t max_size;
+    std::vector<uint32_t> hist;
+    std::vector<uint16_t> touched;
+    String key;
+    robin_hood::unordered_map<String, LrtRes> cache;
+};
+
+// order of the INFO keys of WriteVcf given the population groups. fixed key
+// i is -1 - i, group g is g
+std::vector<int32_t> VcfInfoOrder(const std::vector<String>& groups);
+
+// append the GT:AB:SO:BP columns of N samples, sam is sorted and parallel to aiv
+void SampleColumns(String& out, const BaseV& alt_bases, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, int32_t N);
+
+// fill rec with the bcf record of a called site, the binary twin of WriteVcf.
+// N is the number of sample columns in both, 0 for sites only output
+void WriteBcf(const BaseType& bt, bcf_hdr_t* hdr, bcf1_t* rec, const String& chr, int32_t pos, int8_t ref_base, const AlleleInfoVector& aiv, const std::vector<int32_t>& sam, const std::vector<String>& groups, int32_t N, SiteSum& sum, FisherCache& fisher);
 
 #endif
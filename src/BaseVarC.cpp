@@ -1,5 +1,6 @@
 #include <getopt.h>
 #include <iterator>
+#include <deque>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -8,14 +9,23 @@
 #include <unistd.h>
 
 #include "htslib/bgzf.h"
+#include "htslib/tbx.h"
+#include "htslib/thread_pool.h"
 #include "RefReader.h"
 #include "BamProcess.h"
 #include "BaseType.h"
 #include "ThreadPool.h"
+#include "TaskScheduler.h"
+#include "ReorderQueue.h"
 #define FMT_HEADER_ONLY
 #include "fmt/format.h"
 #include "robin_hood.h"
 
+#define BT_CHUNK 8192    // positions of each output chunk of basetype
+#define BT_WIN 64        // positions of each task calling a part of a chunk
+#define PM_GAP 5000      // popmatrix sites closer than this share one index jump
+#define PM_FANIN 32      // inputs joined at once by each pass of transpose
+
 #define AUTHOR "Zilong Li"
 #define EMAIL "[zimusen94@gmail.com]"
 
@@ -25,7 +35,11 @@ static const char* BASEVARC_USAGE_MESSAGE =
 "Commands:\n"
 "         basetype       Variants Caller\n"
 "         popmatrix      Create population matrix\n" 
-"         concat         Concat popmatrix\n";
+"         concat         Concat popmatrix\n"
+"         expand         Expand sites only variants to full VCF\n"
+"         cvgview        View or query the columnar cvg as text\n"
+"         pmview         Export a binary popmatrix as text\n"
+"         transpose      Transpose popmatrix to one row per site\n";
 
 static const char* BASETYPE_MESSAGE = 
 "Commands: BaseVarC basetype\n"
@@ -40,6 +54,12 @@ static const char* BASETYPE_MESSAGE =
 "  --thread,     -t <INT>   Number of threads\n"
 "  --batch,      -b <INT>   Number of samples each batch\n"
 "  --maf,        -a <FLOAT> Minimum allele count frequency [min(0.001, 100/N, maf)]\n"
+"  --lrt_cache,     <INT>   Cache LRT results of up to INT distinct pileups per thread [0, off]\n"
+"  --em_depth,      <INT>   Let idle threads help the EM of sites with depth >= INT [100000, 0 off]\n"
+"  --output_format, <STR>   Variants output format, vcf or bcf [vcf]\n"
+"  --sites_only,            Output variants without samples, genotypes go to a sparse .spl.gz, vcf format only\n"
+"  --compress_thread, <INT> Compress outputs and tmp files on INT more threads [0, off]\n"
+"  --cvg_format,    <STR>   Coverage output format, txt or bin (columnar .cvb.gz) [txt]\n"
 "  --load,                  Load data only\n"
 "  --rerun,                 Read previous loaded data and rerun\n"
 "  --keep_tmp,              Don't remove tmp files when basetype finished\n"
@@ -52,15 +72,75 @@ static const char* POPMATRIX_MESSAGE =
 "  --input,      -i        BAM/CRAM files list, one file per row.\n"
 "  --output,     -o        Output file path\n"
 "  --posfile,    -p        Position file without header <CHR POS REF ALT>\n"
-"  --reference,  -r        Reference file\n"
-"  --mapq,       -q <INT>  Mapping quality >= INT [10]\n";
+"  --mapq,       -q <INT>  Mapping quality >= INT [10]\n"
+"  --thread,     -t <INT>  Number of threads [1]\n"
+"  --matrix_format, <STR>  Matrix output format, txt or bin (2 bits per call) [txt]\n";
 
 static const char* CONCAT_MESSAGE =
 "Commands: BaseVarC concat\n"
 "Usage   : BaseVarC concat [options]\n\n"
 "Options :\n"
 "  --input,      -i       List of matrix files for concat, one file per row.\n"
-"  --output,     -o       Output filename prefix(.gz will be added auto)\n";
+"  --output,     -o       Output filename prefix(.gz will be added auto)\n"
+"  --thread,     -t <INT> Number of threads [1]\n"
+"  --mem,          <INT> Memory for the blocks of rows in MB [1024]\n";
+
+static const char* EXPAND_MESSAGE =
+"Commands: BaseVarC expand\n"
+"Usage   : BaseVarC expand [options]\n\n"
+"Options :\n"
+"  --input,      -i       Output prefix of basetype --sites_only, <prefix>.vcf.gz and <prefix>.spl.gz are read\n"
+"  --output,     -o       Output filename prefix(.vcf.gz will be added auto)\n";
+
+static const char* TRANSPOSE_MESSAGE =
+"Commands: BaseVarC transpose\n"
+"Usage   : BaseVarC transpose [options]\n\n"
+"Options :\n"
+"  --input,      -i        Popmatrix file, text or binary\n"
+"  --output,     -o        Output file, one row per site after the header <M N>\n"
+"  --thread,     -t <INT>  Number of threads [1]\n"
+"  --matrix_format, <STR>  Matrix output format, txt or bin (2 bits per call) [txt]\n"
+"  --mem,           <INT>  Memory for the tiles and the merge in MB [1024]\n"
+"  --keep_tmp,             Don't remove the tiles when transpose finished\n";
+
+static const char* PMVIEW_MESSAGE =
+"Commands: BaseVarC pmview\n"
+"Usage   : BaseVarC pmview [options]\n\n"
+"Options :\n"
+"  --input,      -i       Binary popmatrix file, of popmatrix, concat or transpose\n"
+"  --output,     -o       Output text popmatrix file, - for plain text to stdout\n";
+
+static const char* CVGVIEW_MESSAGE =
+"Commands: BaseVarC cvgview\n"
+"Usage   : BaseVarC cvgview [options]\n\n"
+"Options :\n"
+"  --input,      -i       Output prefix of basetype --cvg_format bin, <prefix>.cvb.gz is read\n"
+"  --output,     -o       Output filename prefix(.cvg.gz will be added auto), - for plain text to stdout\n"
+"  --region,     -s       Samtools-like region <chr:start-end>, only sites in it are output\n";
+
+// magic of the sparse genotypes file, followed by the number of samples and
+// the tab separated sample names. each record of a called site is then
+// pos, n, and sample index[n], base[n], strand[n], qual[n] of covered samples
+static const char SPL_MAGIC[4] = {'S', 'P', 'L', 1};
+
+// magic of the columnar cvg file, followed by the length of the tab
+// separated chr and group names. blocks of sites follow, see CvbBlock.
+// its .cvi index is the magic and the beg, end and virtual offset of each block
+static const char CVB_MAGIC[4] = {'C', 'V', 'B', 1};
+static const char CVI_MAGIC[4] = {'C', 'V', 'I', 1};
+
+// magic of the binary popmatrix, followed by N, M and the length of the
+// site list, one "CHR POS REF ALT" line per site. each of the N rows is then
+// M calls of 2 bits, 0 for '0', 1 for '1' and 2 for '.', 4 calls per byte
+// from the low bits up and the last byte padded with 0
+static const char PMB_MAGIC[4] = {'P', 'M', 'B', 1};
+// the same layout with M rows of N calls, written by transpose
+static const char PMT_MAGIC[4] = {'P', 'M', 'T', 1};
+
+// first line of every tmp batch file of basetype, the version of the layout,
+// then BT_CHUNK, the threads, the batch size and the positions it was written
+// with. chunk c of the positions is in the files of thread c % threads
+static const char* BT_TMP_TAG = "##BaseVarC_tmp\t1";
 
 static const char* CVG_HEADER =
 "##fileformat=CVGv1.0\n"
@@ -73,13 +153,13 @@ static const char* VCF_HEADER =
 "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n"
 "##FORMAT=<ID=AB,Number=1,Type=String,Description=\"Allele Base\">\n"
 "##FORMAT=<ID=SO,Number=1,Type=String,Description=\"Strand orientation of the mapping base. Marked as + or -\">\n"
-"##FORMAT=<ID=BP,Number=1,Type=String,Description=\"Base Probability which calculate by base quality\">\n"
+"##FORMAT=<ID=BP,Number=1,Type=Float,Description=\"Base Probability which calculate by base quality\">\n"
 "##INFO=<ID=CM_AF,Number=A,Type=Float,Description=\"An ordered, comma delimited list of allele frequencies base on LRT algorithm\">\n"
 "##INFO=<ID=CM_CAF,Number=A,Type=Float,Description=\"An ordered, comma delimited list of allele frequencies just base on read count\">\n"
 "##INFO=<ID=CM_AC,Number=A,Type=Integer,Description=\"An ordered, comma delimited allele depth in CMDB\">\n"
-"##INFO=<ID=CM_DP,Number=A,Type=Integer,Description=\"Total Depth\">\n"
-"##INFO=<ID=SB_REF,Number=A,Type=Integer,Description=\"Read number support REF: Forward,Reverse\">\n"
-"##INFO=<ID=SB_ALT,Number=A,Type=Integer,Description=\"Read number support ALT: Forward,Reverse\">\n"
+"##INFO=<ID=CM_DP,Number=1,Type=Integer,Description=\"Total Depth\">\n"
+"##INFO=<ID=SB_REF,Number=2,Type=Integer,Description=\"Read number support REF: Forward,Reverse\">\n"
+"##INFO=<ID=SB_ALT,Number=2,Type=Integer,Description=\"Read number support ALT: Forward,Reverse\">\n"
 "##INFO=<ID=FS,Number=1,Type=Float,Description=\"Phred-scaled p-value using Fisher's exact test to detect strand bias\">\n"
 "##INFO=<ID=BaseQRankSum,Number=1,Type=Float,Description=\"Phred-score from Wilcoxon rank sum test of Alt Vs. Ref base qualities\">\n"
 "##INFO=<ID=SOR,Number=1,Type=Float,Description=\"Symmetric Odds Ratio of 2x2 contingency table to detect strand bias\">\n"
@@ -92,32 +172,273 @@ typedef std::vector<String> StringV;
 typedef std::vector<int32_t> IntV;
 typedef std::vector<PosAlleleMap> PosAlleleMapVec;
 typedef std::map<String, IntV> GroupIdx;
-typedef robin_hood::unordered_map<String, int> IndelMap;
 
 struct BtRes
 {
     String  cvg;
     String  vcf;
+    int32_t em_iter = 0;
+};
+
+struct BtIdx
+{
+    uint64_t off0 = 0;            // virtual offset of the first record
+    IntV pos;                     // 0-based position of each record
+    std::vector<uint64_t> off;    // virtual offset right after each record
+    int32_t tid = 0;              // bcf contig id, and the csi shape
+    int32_t nids = 0;
+    int32_t n_lvls = 5;
+};
+
+// a block of the columnar cvg, the sites of one chunk column by column. on
+// disk it is n and the number of group columns, then the columns in order
+struct CvbBlock
+{
+    IntV pos;
+    String ref;
+    IntV depth[NTYPE];            // A, C, G, T
+    IntV strand[4];               // REF_FWD, REF_REV, ALT_FWD, ALT_REV
+    std::vector<double> fs, sor;
+    std::vector<IntV> gr_depth;   // [group * NTYPE + base]
+    IntV indel_end;               // end of the Indels text of each site
+    String indel;
+};
+
+struct CvbIdx
+{
+    int32_t beg, end;             // 1-based positions of the first and last site
+    uint64_t off;                 // virtual offset of the block
+};
+
+// the output of BT_CHUNK positions, compressed once its windows are joined.
+// chunk 0 holds the headers, its vcf is plain text for bcf output
+struct BtChunk
+{
+    String vcf, cvg, spl;          // bgzf blocks
+    BtIdx vidx, cidx;              // offsets relative to the chunk
+    CvbBlock col;                  // sites of the columnar cvg
+    std::vector<bcf1_t*> recs;     // bcf records, encoded by the writer
+};
+typedef BaseVarC::ReorderQueue<BtChunk> BtQueue;
+typedef BaseVarC::ReorderQueue<std::string> PmQueue;
+
+// a run of popmatrix sites on one chromosome, read with one index jump
+struct PmCluster
+{
+    String rg;                    // samtools-like region of the sites
+    PosInfoVector pv;
+};
+
+// an input of concat, rows are found through its bgzf blocks
+struct PmIn
+{
+    String fn;
+    int32_t m = 0;
+    bool bin = false;
+    int64_t hlen = 0;             // uncompressed length of the header
+    std::vector<int64_t> coff;    // file offset of each bgzf block
+    std::vector<int64_t> uoff;    // and its uncompressed offset
+};
+
+struct BtSite
+{
+    int32_t p;
+    AlleleInfoVector aiv;
+    IntV sam;    // sample of each aiv entry, increasing
+};
+
+// a batch of bams of bt_r, its tmp files are written by the task that
+// reads its last bam
+struct BrBatch
+{
+    int ib;
+    int32_t b, e;                 // bams [b, e)
+    PosAlleleMapVec allele_mv;
+    StringV names;
+    std::atomic<int32_t> left;    // bams not read yet
+    std::atomic<int32_t> count;
+    std::atomic<bool> bad;
+};
+
+// shared by the tasks of bt_r
+struct BrCtx
+{
+    const StringV& bams;
+    const IntV& pv;
+    const String& refseq;
+    const String& region;
+    const String& fout;
+    int32_t rg_s;
+    int bc, first, thread;
+    hts_tpool* io_pool;
+    std::vector<std::unique_ptr<BrBatch>> batches;   // batch first + i
+    std::mutex m;
+    std::condition_variable cv;
+    int open = 0;                 // batches being read or written
+    bool fail = false;
+    BrCtx(const StringV& bams, const IntV& pv, const String& refseq, const String& region, const String& fout, int32_t rg_s, int bc, int first, int thread, hts_tpool* io_pool)
+        : bams(bams), pv(pv), refseq(refseq), region(region), fout(fout), rg_s(rg_s), bc(bc), first(first), thread(thread), io_pool(io_pool) {}
+};
+
+// the tmp files of one thread of bt_r, a chunk is loaded from them only
+// after the one before it, see bt_s
+struct BtStream
+{
+    std::vector<BGZF*> fpv;
+    kstring_t ks = {0, 0, NULL};
+    AlleleInfo ai;
+    int64_t next = 0;             // the chunk to load next
+};
+
+// what a worker of the scheduler keeps between the windows it calls
+struct BtWorker
+{
+    LrtCache cache;
+    FisherCache fisher;
+    SiteSum sum;
+    BtRes btr;
+    String spl;
+    std::vector<BaseType> bts;
+    bcf_hdr_t* hdr = NULL;
+    bcf1_t* rec = NULL;
+    int64_t count = 0, em_iter = 0;
+    BtWorker(int lrt_cache): cache(lrt_cache) {}
+};
+
+struct BtCtx;
+struct BtJob;
+
+// about BT_WIN positions of a chunk, called by one task
+struct BtWin
+{
+    BtJob* job;
+    std::vector<BtSite> sites;
+    BtChunk out;
+};
+
+// a chunk in flight, the task finishing its last window joins the
+// windows and hands the chunk on
+struct BtJob
+{
+    BtCtx* x;
+    int64_t c;
+    std::vector<std::unique_ptr<BtWin>> wins;
+    std::atomic<int32_t> left;    // windows not called yet, and one for the loader
+};
+
+// shared by the tasks of bt_s
+struct BtCtx
+{
+    const IntV& pv;
+    const String& refseq;
+    const String& chr;
+    int32_t rg_s, N;
+    StringV groups;
+    IntV sam_grp, info_order;
+    BtQueue& queue;
+    BaseVarC::TaskScheduler& sched;
+    BaseVarC::TaskGroup group;
+    BaseVarC::ThreadPool* gz_pool;
+    std::vector<std::future<void>> gz_res;
+    std::vector<BtStream> streams;
+    std::vector<std::unique_ptr<BtWorker>> workers;
+    std::atomic<size_t> inflight; // windows loaded and not called yet
+    std::atomic<bool> fail;
+    std::mutex m;                 // guards streams' next and gz_res
+    std::condition_variable cv;
+    BtCtx(const IntV& pv, const String& refseq, const String& chr, int32_t rg_s, int32_t N, BtQueue& queue, BaseVarC::TaskScheduler& sched, BaseVarC::ThreadPool* gz_pool)
+        : pv(pv), refseq(refseq), chr(chr), rg_s(rg_s), N(N), queue(queue), sched(sched), gz_pool(gz_pool), inflight(0), fail(false) {}
+    // however bt_s ends, the compressions still queued on gz_pool use the
+    // context, so they are waited for (their errors are already seen or
+    // lost to the first one) before the files and headers are freed
+    ~BtCtx()
+    {
+        for (auto && r : gz_res) if (r.valid()) r.wait();
+        for (auto & st : streams) {
+            for (auto & fp: st.fpv) bgzf_close(fp);
+            free(st.ks.s);
+        }
+        for (auto & w : workers) {
+            if (w->rec) bcf_destroy(w->rec);
+            if (w->hdr) bcf_hdr_destroy(w->hdr);
+        }
+    }
 };
 
 void runBaseType(int argc, char **argv);
 void runPopMatrix(int argc, char **argv);
 void runConcat(int argc, char **argv);
+void runExpand(int argc, char **argv);
+void runCvgView(int argc, char **argv);
+void runPmView(int argc, char **argv);
+void runTranspose(int argc, char **argv);
 void parseOptions(int argc, char **argv, const char* msg);
 
-void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const String& region, const String& fout, int nb, int bc, int ib, int32_t rg_s, int thread);
-void bt_s(const StringV& ftmp_v, const IntV& pv, const String& refseq, const String& chr, int32_t rg_s, int32_t N, int thread, int ithread);
-BtRes bt_f(int32_t p, const GroupIdx& popg_idx, const AlleleInfoVector& aiv, const DepM& idx, int32_t N, const String& chr, int32_t rg_s, const String& refseq);
+void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const String& region, const String& fout, int nb, int bc, int first, int32_t rg_s, int thread, BaseVarC::TaskScheduler& sched, hts_tpool* io_pool);
+void bt_rb(void* ctx, size_t k);
+void bt_rd(BrCtx& x, BrBatch& b);
+void bt_rw(BrCtx& x, BrBatch& b);
+String bt_tag(int thread, int bc, int64_t psize);
+bool bt_tagged(BGZF* fp, const String& tag, kstring_t* ks);
+void bt_s(const std::vector<StringV>& ftmp_vv, const IntV& pv, const String& refseq, const String& chr, int32_t rg_s, int32_t N, BtQueue& queue, BaseVarC::TaskScheduler& sched, BaseVarC::ThreadPool* gz_pool, hts_tpool* io_pool);
+void bt_l(void* ctx, size_t c);
+void bt_load(BtCtx& x, BtStream& st, BtJob& job);
+void bt_post(BtCtx& x, BtJob& job, std::unique_ptr<BtWin>& win);
+void bt_c(void* ctx, size_t);
+void bt_call(BtCtx& x, BtWorker& wk, BtWin& win);
+void bt_done(BtJob* job);
+void bt_join(BtJob* job);
+void bt_fail(BtCtx& x);
+void bt_cat(BtChunk& a, const BtChunk& b);
+void bt_w(BtQueue& queue, const String& chr, std::exception_ptr& err);
+void bt_wf(BtQueue& queue, const String& chr);
+void bt_z(BtQueue& queue, size_t seq, std::shared_ptr<BtChunk> chunk);
+void bt_zp(BtCtx& x, size_t seq, std::shared_ptr<BtChunk> chunk);
+void bt_gz(const String& in, String& out, std::vector<uint64_t>* off);
+void bt_fw(FILE* fp, const String& s);
+hts_idx_t* bt_idx_init(const BtIdx& bi, int fmt, int preset, const String& chr);
+void bt_idx_push(hts_idx_t* idx, const BtIdx& bi, uint64_t coff);
+bool bt_lrt(const BtSite& site, int32_t N, int32_t rg_s, const String& refseq, LrtCache& cache, std::vector<BaseType>& bts);
+void bt_sum(const BtSite& site, const IntV& sam_grp, int32_t ngroup, int8_t ref_base, const BaseType& bt, bool bt_success, SiteSum& sum);
+void bt_f(const BtSite& site, const StringV& groups, const IntV& sam_grp, const IntV& info_order, int32_t N, const String& chr, int32_t rg_s, const String& refseq, BaseType& bt, bool bt_success, LrtCache& cache, FisherCache& fisher, SiteSum& sum, bcf_hdr_t* hdr, bcf1_t* rec, BtRes& res);
+double bt_minaf(int32_t N);
+void bt_spl(const BtSite& site, String& out);
+bool bt_spl_read(BGZF* fp, BtSite& site);
+void bt_cvb_push(CvbBlock& b, int32_t p, char ref, const SiteSum& sum);
+void bt_cvb_cat(CvbBlock& a, const CvbBlock& b);
+void bt_cvb(const CvbBlock& b, String& out);
+bool bt_cvb_read(BGZF* fp, CvbBlock& b);
+void bt_cvb_text(const CvbBlock& b, size_t i, const String& chr, String& out);
+void pm_f(const String& bam, size_t i, const std::vector<PmCluster>& cls, PmQueue& queue);
+void pm_w(PmQueue& queue, BGZF* fp, std::exception_ptr& err);
+void pm_pack(const String& row, String& out);
+void pm_unpack(const String& row, int32_t m, String& out);
+void pm_cat(String& out, int32_t n, const String& row, int32_t m);
+BGZF* pm_open(const String& fn, int32_t& n, int32_t& m, String& sites, bool& bin, int64_t& hlen, bool* site_major = NULL);
+void pm_blocks(PmIn& in);
+void pm_seek(BGZF* fp, const PmIn& in, int64_t u);
+void pm_cc(const std::vector<PmIn>& ins, int32_t n, int32_t rows, int thread, int ithread, PmQueue& queue);
+void pm_cw(PmQueue& queue, FILE* fp, std::exception_ptr& err);
+void pm_concat(const std::vector<PmIn>& ins, int32_t n, int32_t mt, const String& head, const String& fo);
+void pm_tile(const PmIn& in, int32_t r0, int32_t r1, bool bin, const String& fn);
 
 namespace opt {
     static bool verbose = false;
     static bool rerun   = false;
     static bool load    = false;
     static bool keep_tmp= false;
+    static bool sites_only = false;
     static int mapq = 10;
     static int thread = 1;
     static int batch  = 10;    // be careful, need to check 
+    static int lrt_cache = 0;
+    static int em_depth = 100000;
+    static int compress_thread = 0;
+    static int mem = 1024;
     static double maf = 0.001;
+    static std::string output_format = "vcf";
+    static std::string cvg_format = "txt";
+    static std::string matrix_format = "txt";
     static std::string input;
     static std::string reference;
     static std::string posfile;
@@ -134,6 +455,18 @@ static const struct option longopts[] = {
   { "keep_tmp",                no_argument, NULL,  6  },
   { "load",                    no_argument, NULL,  7  },
   { "rerun",                   no_argument, NULL,  8  },
+  { "lrt_cache",               required_argument, NULL,  9  },
+  { "em_depth",                required_argument, NULL,  10 },
+  { "output_format",           required_argument, NULL,  12 },
+  { "output-format",           required_argument, NULL,  12 },
+  { "sites_only",              no_argument, NULL,  13 },
+  { "sites-only",              no_argument, NULL,  13 },
+  { "compress_thread",         required_argument, NULL,  14 },
+  { "cvg_format",              required_argument, NULL,  15 },
+  { "cvg-format",              required_argument, NULL,  15 },
+  { "matrix_format",           required_argument, NULL,  16 },
+  { "matrix-format",           required_argument, NULL,  16 },
+  { "mem",                     required_argument, NULL,  17 },
   { "maf",                     required_argument, NULL, 'a' },
   { "input",                   required_argument, NULL, 'i' },
   { "reference",               required_argument, NULL, 'r' },
@@ -164,6 +497,14 @@ int main(int argc, char** argv)
             runPopMatrix(argc - 1, argv + 1);
         } else if (command == "concat") {
             runConcat(argc - 1, argv + 1);
+        } else if (command == "expand") {
+            runExpand(argc - 1, argv + 1);
+        } else if (command == "cvgview") {
+            runCvgView(argc - 1, argv + 1);
+        } else if (command == "pmview") {
+            runPmView(argc - 1, argv + 1);
+        } else if (command == "transpose") {
+            runTranspose(argc - 1, argv + 1);
         } else {
             std::cerr << BASEVARC_USAGE_MESSAGE;
             return 0;
@@ -180,6 +521,19 @@ void runBaseType(int argc, char **argv)
     if (opt::reference.empty()) {
         throw std::invalid_argument("reference must be feed");
     }
+    if (opt::output_format != "vcf" && opt::output_format != "bcf") {
+        throw std::invalid_argument("output format must be vcf or bcf");
+    }
+    // expand reads the sites back from the .vcf.gz
+    if (opt::sites_only && opt::output_format == "bcf") {
+        throw std::invalid_argument("sites only works with vcf output format");
+    }
+    if (opt::cvg_format != "txt" && opt::cvg_format != "bin") {
+        throw std::invalid_argument("cvg format must be txt or bin");
+    }
+    if (opt::lrt_cache < 0) {
+        throw std::invalid_argument("lrt cache must be 0 or more");
+    }
     time_t tim = time(0);
     clock_t ctb = clock();
     std::cout << "basetype start -- " << ctime(&tim);
@@ -215,6 +569,9 @@ void runBaseType(int argc, char **argv)
     int bc = opt::batch;
     int ngz = 0, nb = 1 + (N - 1) / bc;    // ceiling
     int bk = nb - 1;
+    // a rerun only reads back the files written with the same layout
+    const String tag = bt_tag(thread, bc, pv.size());
+    kstring_t ks = {0, 0, NULL};
     for (int j = 0; j < nb; ++j) {
         int k = 0;
         for (int i = 0; i < thread; ++i) {
@@ -222,80 +579,67 @@ void runBaseType(int argc, char **argv)
             ftmp_vv[i].push_back(tmp);
             if (BaseVarC::exists(tmp)) {
                 BGZF* fp = bgzf_open(tmp.c_str(), "r");
-                if (bgzf_compression(fp) == 2) {
-                    if (bgzf_check_EOF(fp) == 1) { k +=1; ngz += 1; }
+                if (fp && bgzf_compression(fp) == 2) {
+                    if (bgzf_check_EOF(fp) == 1) {
+                        if (opt::rerun && !bt_tagged(fp, tag, &ks)) {
+                            bgzf_close(fp);
+                            free(ks.s);
+                            throw std::runtime_error("ERROR: " + tmp + " was loaded with other threads, batch, region or version, remove the tmp files to rerun");
+                        }
+                        k +=1; ngz += 1;
+                    }
                 } else {
                     std::cerr << "warning: " << tmp << " is not bgziped" << std::endl;
                 }
+                if (fp) bgzf_close(fp);
             }
         }
         if (k != thread) bk = bk > j ? j : bk;
     }
-    if (opt::rerun && ngz > 0) {
-        if (ngz != thread * nb) {
-            BaseVarC::ThreadPool pool(thread);
-            std::vector<std::future<void>> res;
-            std::cerr << "begin to extract reads from bam" << std::endl;
-            for (int i = bk; i < nb; ++i) {
-                res.emplace_back(pool.enqueue(bt_r, std::cref(bams), std::cref(pv), std::cref(refseq), std::cref(opt::region), std::cref(opt::output), nb, bc, i, rg_s, thread));
-            }
-            for (auto && r: res) {
-                r.get();
-            }
-            res.clear();
-        }
-    } else {
-        BaseVarC::ThreadPool pool(thread);
-        std::vector<std::future<void>> res;
+    free(ks.s);
+    // bgzf of the tmp files runs on its own threads, shared by all files
+    hts_tpool* io_pool = opt::compress_thread > 0 ? hts_tpool_init(opt::compress_thread) : NULL;
+    // both stages run as small tasks on one work-stealing scheduler
+    BaseVarC::TaskScheduler sched(thread);
+    if (!opt::rerun || ngz == 0 || ngz != thread * nb) {
         std::cerr << "begin to extract reads from bam" << std::endl;
-        for (int i = 0; i < nb; ++i) {
-            res.emplace_back(pool.enqueue(bt_r, std::cref(bams), std::cref(pv), std::cref(refseq), std::cref(opt::region), std::cref(opt::output), nb, bc, i, rg_s, thread));
-        }
-        for (auto && r: res) {
-            r.get();
-        }
-        res.clear();
+        bt_r(bams, pv, refseq, opt::region, opt::output, nb, bc, opt::rerun && ngz > 0 ? bk : 0, rg_s, thread, sched, io_pool);
     }
     time_t tim1 = time(0);
     std::cout << "basetype loading done -- " << ctime(&tim1);
-    if (opt::load) exit(EXIT_SUCCESS);
-    // begin to call basetype
-    std::vector<std::thread> workers;
-    for (int i = 0; i < thread; ++i) {
-        workers.push_back(std::thread(bt_s, std::cref(ftmp_vv[i]), std::cref(pv), std::cref(refseq), std::cref(chr), rg_s, N, thread, i));
+    if (opt::load) {
+        if (io_pool) hts_tpool_destroy(io_pool);
+        exit(EXIT_SUCCESS);
     }
-    // merge all subfile
-    String vcfout = opt::output + ".vcf.gz", subvcf;
-    String cvgout = opt::output + ".cvg.gz", subcvg;
-    BGZF* fov = bgzf_open(vcfout.c_str(), "w");
-    BGZF* foc = bgzf_open(cvgout.c_str(), "w");
-    BGZF* fiv = NULL; BGZF* fic = NULL;
-    kstring_t ks = {0, 0, NULL};
-    for (int i = 0; i < thread; ++i) {
-        auto & t = workers[i];
-        if (t.joinable()) t.join();
-        subvcf = fmt::format("{}.{}.vcf.gz", opt::output, i);
-        subcvg = fmt::format("{}.{}.cvg.gz", opt::output, i);
-        fiv = bgzf_open(subvcf.c_str(), "r");
-        fic = bgzf_open(subcvg.c_str(), "r");
-        while (bgzf_getline(fiv, '\n', &ks) >= 0) {
-            tmp = (String)ks.s + '\n';
-            if (bgzf_write(fov, tmp.c_str(), tmp.length()) != tmp.length()) {
-                throw std::runtime_error("ERROR: fail to write");
-            }
-        }
-        while (bgzf_getline(fic, '\n', &ks) >= 0) {
-            tmp = (String)ks.s + '\n';
-            if (bgzf_write(foc, tmp.c_str(), tmp.length()) != tmp.length()) {
-                throw std::runtime_error("ERROR: fail to write");
-            }
-        }
-        std::remove(subvcf.c_str());
-        std::remove(subcvg.c_str());
+    // begin to call basetype
+    // the EM of very deep sites is split into tasks of the same scheduler,
+    // taken off again whichever way calling ends
+    struct EMScope {
+        EMScope(BaseVarC::TaskScheduler* sched, int32_t depth) { SetEMPool(sched, depth); }
+        ~EMScope() { SetEMPool(NULL, 0); }
+    } em_scope(&sched, opt::em_depth);
+    // chunks are written in order as they are done
+    BtQueue queue(2 * thread + 1);
+    std::exception_ptr werr;
+    std::thread writer(bt_w, std::ref(queue), std::cref(chr), std::ref(werr));
+    // chunks are compressed on their own threads while calling goes on
+    std::unique_ptr<BaseVarC::ThreadPool> gz_pool;
+    if (opt::compress_thread > 0) gz_pool.reset(new BaseVarC::ThreadPool(opt::compress_thread));
+    try {
+        bt_s(ftmp_vv, pv, refseq, chr, rg_s, N, queue, sched, gz_pool.get(), io_pool);
+    } catch (...) {
+        gz_pool.reset();
+        if (io_pool) hts_tpool_destroy(io_pool);
+        queue.close();
+        writer.join();
+        throw;
     }
-    std::cout << "merge subfiles done" << std::endl;
-    if (bgzf_close(fov) < 0) std::cerr << "warning: file cannot be closed" << std::endl;
-    if (bgzf_close(foc) < 0) std::cerr << "warning: file cannot be closed" << std::endl;
+    gz_pool.reset();
+    if (io_pool) hts_tpool_destroy(io_pool);
+    queue.close();
+    writer.join();
+    if (werr) std::rethrow_exception(werr);
+    std::cout << "write outputs done" << std::endl;
     for (int i = 0; i < thread; ++i) {
         tmp = fmt::format("{}.tmp.thread.{}", opt::output, i);
         // for unix-system;
@@ -313,26 +657,33 @@ void runBaseType(int argc, char **argv)
     return;
 }
 
-void bt_s(const StringV& ftmp_v, const IntV& pv, const String& refseq, const String& chr, int32_t rg_s, int32_t N, int thread, int ithread)
+void bt_s(const std::vector<StringV>& ftmp_vv, const IntV& pv, const String& refseq, const String& chr, int32_t rg_s, int32_t N, BtQueue& queue, BaseVarC::TaskScheduler& sched, BaseVarC::ThreadPool* gz_pool, hts_tpool* io_pool)
 {
-    // hold all tmp file pointers
     String headcvg = String(CVG_HEADER);
     String headvcf = String(VCF_HEADER);
-    String vcfout = fmt::format("{}.{}.vcf.gz", opt::output, ithread);
-    String cvgout = fmt::format("{}.{}.cvg.gz", opt::output, ithread);
-    BGZF* fpv = bgzf_open(vcfout.c_str(), "w");
-    BGZF* fpc = bgzf_open(cvgout.c_str(), "w");
-    BGZF* fpi;
-    std::vector<BGZF*> fpiv;
-    for (auto & f: ftmp_v) {
-        fpi = bgzf_open(f.c_str(), "r");
-        fpiv.push_back(fpi);
-    }
-    kstring_t ks = {0, 0, NULL};
+    const bool bcf = opt::output_format == "bcf";
+    const bool cvb = opt::cvg_format == "bin";
+    BtCtx x(pv, refseq, chr, rg_s, N, queue, sched, gz_pool);
+    // hold all tmp file pointers, every file starts with its tag and the
+    // names of its batch
+    const int thread = ftmp_vv.size();
+    const String tag = bt_tag(thread, opt::batch, pv.size());
     String sams;
-    for (auto & fp: fpiv) {
-        if (bgzf_getline(fp, '\n', &ks) >= 0) {
-            sams += (String)ks.s;
+    x.streams.resize(thread);
+    for (int i = 0; i < thread; ++i) {
+        auto & st = x.streams[i];
+        st.next = i;
+        for (auto & f: ftmp_vv[i]) {
+            BGZF* fpi = bgzf_open(f.c_str(), "r");
+            if (!fpi) throw std::runtime_error("ERROR: fail to open " + f);
+            if (io_pool) bgzf_thread_pool(fpi, io_pool, 0);
+            st.fpv.push_back(fpi);
+            if (!bt_tagged(fpi, tag, &st.ks)) {
+                throw std::runtime_error("ERROR: " + f + " was loaded with other threads, batch, region or version");
+            }
+            if (bgzf_getline(fpi, '\n', &st.ks) >= 0 && i == 0) {
+                sams += (String)st.ks.s;
+            }
         }
     }
     sams.pop_back();
@@ -368,6 +719,13 @@ void bt_s(const StringV& ftmp_v, const IntV& pv, const String& refseq, const Str
             }
         }
     }
+    // group id of each sample in the (sorted) order of popg_idx, -1 if none
+    x.sam_grp.assign(N, -1);
+    for (GroupIdx::iterator it = popg_idx.begin(); it != popg_idx.end(); ++it) {
+        for (auto i : it->second) x.sam_grp[i] = x.groups.size();
+        x.groups.push_back(it->first);
+    }
+    x.info_order = VcfInfoOrder(x.groups);
     // get contig from fai file.
     String fai = opt::reference + ".fai";
     std::ifstream ifai(fai);
@@ -378,35 +736,134 @@ void bt_s(const StringV& ftmp_v, const IntV& pv, const String& refseq, const Str
         }
     }
     headvcf += "##reference=file://" + opt::reference + "\n";
-    headvcf += "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\t" + sams + "\n";
+    headvcf += "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO";
+    headvcf += opt::sites_only ? "\n" : "\tFORMAT\t" + sams + "\n";
     headcvg += "\n";
-    // output header
-    if (ithread == 0) {
-        if (bgzf_write(fpc, headcvg.c_str(), headcvg.length()) != headcvg.length()) {
-            throw std::runtime_error("ERROR: fail to write");
-        }
-        if (bgzf_write(fpv, headvcf.c_str(), headvcf.length()) != headvcf.length()) {
-            throw std::runtime_error("ERROR: fail to write");
+    // output header, the writer encodes the bcf one itself
+    BtChunk head;
+    if (bcf) head.vcf = headvcf;
+    else bt_gz(headvcf, head.vcf, NULL);
+    if (cvb) {
+        String headcvb(CVB_MAGIC, sizeof(CVB_MAGIC)), names = chr;
+        for (auto & g : x.groups) names += "\t" + g;
+        int32_t l = names.length();
+        headcvb.append((const char*)&l, sizeof(l));
+        headcvb += names;
+        bt_gz(headcvb, head.cvg, NULL);
+    } else {
+        bt_gz(headcvg, head.cvg, NULL);
+    }
+    if (opt::sites_only) {
+        String headspl(SPL_MAGIC, sizeof(SPL_MAGIC));
+        int32_t l = sams.length();
+        headspl.append((const char*)&N, sizeof(N));
+        headspl.append((const char*)&l, sizeof(l));
+        headspl += sams;
+        bt_gz(headspl, head.spl, NULL);
+    }
+    queue.push(0, std::move(head));
+    for (size_t k = 0; k < sched.size(); ++k) {
+        x.workers.emplace_back(new BtWorker(opt::lrt_cache));
+        if (bcf) {
+            // every worker encodes with the same header
+            auto & w = *x.workers.back();
+            w.hdr = bcf_hdr_init("r");
+            if (bcf_hdr_parse(w.hdr, &headvcf[0]) < 0) {
+                throw std::runtime_error("ERROR: fail to parse the vcf header");
+            }
+            w.rec = bcf_init();
         }
     }
-    // begin to call basetype and output
-    AlleleInfo ai;
-    AlleleInfoVector aiv;
-    DepM idx;
-    int32_t j, k, i, count=0;
+    // begin to call basetype and output. chunk c is in the files of thread
+    // c % thread, which are read in order, so it is loaded once chunk
+    // c - thread has been. the loaders cut their chunks into windows that any
+    // worker may call, so uneven coverage doesn't leave workers idle
     std::cerr << "begin to load data and run basetype" << std::endl;
+    const int64_t psize = pv.size(), nchunk = (psize + BT_CHUNK - 1) / BT_CHUNK;
+    for (int64_t c = 0; c < nchunk; ++c) {
+        // bounded by the queue, the chunk can be pushed without waiting.
+        // it is closed when the writer or a task failed
+        if (!queue.wait(c + 1)) break;
+        auto & st = x.streams[c % thread];
+        std::unique_lock<std::mutex> lock(x.m);
+        x.cv.wait(lock, [&x, &st, c]{ return x.fail || st.next == c; });
+        if (x.fail) break;
+        lock.unlock();
+        sched.submit(x.group, bt_l, &x, c);
+    }
+    x.group.wait();
+    for (auto && r : x.gz_res) r.get();
+    int64_t em_iter = 0, count = 0;
+    for (size_t k = 0; k < x.workers.size(); ++k) {
+        auto & w = *x.workers[k];
+        em_iter += w.em_iter;
+        count += w.count;
+        if (opt::verbose && opt::lrt_cache > 0) std::cerr << "LRT cache hits " << w.cache.hits << ", misses " << w.cache.misses << ", flushes " << w.cache.flushes << ", hit rate " << w.cache.HitRate() << " -- thread" << k << std::endl;
+    }
+    if (opt::verbose) std::cerr << "basetype took " << em_iter << " EM steps for " << count << " sites" << std::endl;
+    for (auto & st : x.streams) {
+        for (auto & fp: st.fpv) bgzf_close(fp);
+        st.fpv.clear();
+    }
+    // whether remove tmp file or not
+    if (!opt::keep_tmp) {
+        for (auto & ftmp_v : ftmp_vv) {
+            for (auto & f: ftmp_v) {
+                std::remove(f.c_str());
+            }
+        }
+    }
+
+    return;
+}
+
+void bt_l(void* ctx, size_t c)
+{
+    BtCtx& x = *static_cast<BtCtx*>(ctx);
+    BtStream& st = x.streams[c % x.streams.size()];
+    BtJob* job = new BtJob;
+    job->x = &x;
+    job->c = c;
+    job->left = 1;
+    try {
+        if (!x.fail) bt_load(x, st, *job);
+    } catch (...) {
+        bt_fail(x);
+        bt_done(job);
+        throw;
+    }
+    {
+        std::lock_guard<std::mutex> lock(x.m);
+        st.next = c + x.streams.size();
+    }
+    x.cv.notify_all();
+    bt_done(job);
+}
+
+void bt_load(BtCtx& x, BtStream& st, BtJob& job)
+{
+    std::unique_ptr<BtWin> win(new BtWin);
+    AlleleInfo& ai = st.ai;
+    int32_t j, i, npos = 0;
     char *buf=NULL, *str=NULL, *str2=NULL, *pti=NULL, *pto=NULL;
-    int32_t window = pv.size() % thread + pv.size() / thread;
-    IntV::const_iterator itp, itp2;
-    if (ithread == thread - 1) itp2 = pv.end();
-    else itp2 = pv.begin() + (ithread + 1) * window;
-    for (itp = pv.begin() + ithread * window; itp != itp2; ++itp) {
-        auto & p = *itp;
-        j = 0; k = 0;
+    const int64_t psize = x.pv.size();
+    IntV::const_iterator itp, itp2 = x.pv.begin() + std::min(psize, (job.c + 1) * BT_CHUNK);
+    for (itp = x.pv.begin() + job.c * BT_CHUNK; itp != itp2; ++itp) {
+        if (npos >= BT_WIN) {
+            bt_post(x, job, win);
+            npos = 0;
+        }
+        auto & sites = win->sites;
+        sites.emplace_back();
+        auto & site = sites.back();
+        auto & aiv = site.aiv;
+        site.p = *itp;
+        j = 0;
+        ++npos;
         // merge all data together from tmp files
-        for (auto & fp: fpiv) {
-            if (bgzf_getline(fp, '\n', &ks) >= 0) {
-                buf = ks.s;
+        for (auto & fp: st.fpv) {
+            if (bgzf_getline(fp, '\n', &st.ks) >= 0) {
+                buf = st.ks.s;
                 while ((str = strtok_r(buf, " ", &pto)) != NULL) {
                     if (str[0] != '+' && str[0] != '-' && str[0] != 'N' && str[0] != '.') {
                         buf = str;
@@ -426,80 +883,418 @@ void bt_s(const StringV& ftmp_v, const IntV& pv, const String& refseq, const Str
                         // skip N base
                         if (ai.base != 4) {
                             aiv.push_back(ai);
-                            idx.insert({j, k++});
+                            site.sam.push_back(j);
                         }
                     } else if (str[0] != '.') {
                         ai.is_indel = 1;
                         ai.indel = str;
                         aiv.push_back(ai);
-                        idx.insert({j, k++});
+                        site.sam.push_back(j);
                     }
                     buf = NULL;
                     j++;
                 }
             }
         }
-        if (!aiv.empty()) {
-            auto btr = bt_f(p, popg_idx, aiv, idx, N, chr, rg_s, refseq);
-            if (!btr.vcf.empty() && bgzf_write(fpv, btr.vcf.c_str(), btr.vcf.length()) != btr.vcf.length()) {
-                throw std::runtime_error("ERROR: fail to write");
+        if (aiv.empty()) sites.pop_back();
+    }
+    bt_post(x, job, win);
+}
+
+void bt_post(BtCtx& x, BtJob& job, std::unique_ptr<BtWin>& win)
+{
+    if (win->sites.empty()) return;
+    // loaded sites are bounded, the loader calls windows itself meanwhile
+    const size_t most = 2 * x.sched.size();
+    x.sched.help([&x, most]{ return x.inflight < most; });
+    ++x.inflight;
+    ++job.left;
+    win->job = &job;
+    BtWin* w = win.release();
+    job.wins.emplace_back(w);
+    win.reset(new BtWin);
+    x.sched.submit(x.group, bt_c, w, 0);
+}
+
+void bt_c(void* ctx, size_t)
+{
+    BtWin& win = *static_cast<BtWin*>(ctx);
+    BtJob* job = win.job;
+    BtCtx& x = *job->x;
+    try {
+        if (!x.fail) bt_call(x, *x.workers[x.sched.index()], win);
+    } catch (...) {
+        bt_fail(x);
+        --x.inflight;
+        bt_done(job);
+        throw;
+    }
+    --x.inflight;
+    bt_done(job);
+}
+
+void bt_call(BtCtx& x, BtWorker& wk, BtWin& win)
+{
+    const bool bcf = opt::output_format == "bcf";
+    const bool cvb = opt::cvg_format == "bin";
+    BtChunk& out = win.out;
+    auto & sites = win.sites;
+    bool success;
+    for (size_t s = 0; s < sites.size(); ++s) {
+        success = bt_lrt(sites[s], x.N, x.rg_s, x.refseq, wk.cache, wk.bts);
+        bt_f(sites[s], x.groups, x.sam_grp, x.info_order, x.N, x.chr, x.rg_s, x.refseq, wk.bts.back(), success, wk.cache, wk.fisher, wk.sum, wk.hdr, wk.rec, wk.btr);
+        // offsets are the end of each record in the text for now
+        if (success) {
+            if (bcf) out.recs.push_back(bcf_dup(wk.rec));
+            out.vcf += wk.btr.vcf;
+            out.vidx.pos.push_back(sites[s].p - 1);
+            out.vidx.off.push_back(out.vcf.length());
+        }
+        if (opt::sites_only && success) {
+            bt_spl(sites[s], wk.spl);
+            out.spl += wk.spl;
+        }
+        out.cidx.pos.push_back(sites[s].p - 1);
+        if (cvb) {
+            const int8_t ref_base = BASE_INT8_TABLE[static_cast<size_t>(x.refseq[sites[s].p - x.rg_s])];
+            bt_cvb_push(out.col, sites[s].p, BASE2CHAR[ref_base], wk.sum);
+        } else {
+            out.cvg += wk.btr.cvg;
+            out.cidx.off.push_back(out.cvg.length());
+        }
+        wk.em_iter += wk.btr.em_iter;
+        if (!(++wk.count % 1000)) std::cerr << "basetype completed " << wk.count << " sites -- thread" << x.sched.index() << std::endl;
+    }
+    std::vector<BtSite>().swap(win.sites);
+}
+
+void bt_done(BtJob* job)
+{
+    if (--job->left == 0) bt_join(job);
+}
+
+void bt_join(BtJob* job)
+{
+    std::unique_ptr<BtJob> hold(job);
+    BtCtx& x = *job->x;
+    std::shared_ptr<BtChunk> chunk = std::make_shared<BtChunk>();
+    for (auto & w : job->wins) bt_cat(*chunk, w->out);
+    job->wins.clear();
+    if (x.fail) {
+        for (auto & r : chunk->recs) bcf_destroy(r);
+        return;
+    }
+    try {
+        if (x.gz_pool) {
+            std::lock_guard<std::mutex> lock(x.m);
+            x.gz_res.emplace_back(x.gz_pool->enqueue(bt_zp, std::ref(x), job->c + 1, chunk));
+        } else {
+            bt_z(x.queue, job->c + 1, chunk);
+        }
+    } catch (...) {
+        bt_fail(x);
+        throw;
+    }
+}
+
+// a task failed, the other ones stop and nothing waits for its chunk
+void bt_fail(BtCtx& x)
+{
+    {
+        std::lock_guard<std::mutex> lock(x.m);
+        x.fail = true;
+    }
+    x.cv.notify_all();
+    x.queue.close();
+}
+
+void bt_cat(BtChunk& a, const BtChunk& b)
+{
+    // b goes after a, so do the offsets in its texts
+    for (auto o : b.vidx.off) a.vidx.off.push_back(o + a.vcf.length());
+    for (auto o : b.cidx.off) a.cidx.off.push_back(o + a.cvg.length());
+    a.vidx.pos.insert(a.vidx.pos.end(), b.vidx.pos.begin(), b.vidx.pos.end());
+    a.cidx.pos.insert(a.cidx.pos.end(), b.cidx.pos.begin(), b.cidx.pos.end());
+    a.vcf += b.vcf;
+    a.cvg += b.cvg;
+    a.spl += b.spl;
+    a.recs.insert(a.recs.end(), b.recs.begin(), b.recs.end());
+    if (!b.col.pos.empty()) bt_cvb_cat(a.col, b.col);
+}
+
+// the writer thread. its error is kept for runBaseType, and the queue is
+// closed so the callers stop instead of waiting for it
+void bt_w(BtQueue& queue, const String& chr, std::exception_ptr& err)
+{
+    try {
+        bt_wf(queue, chr);
+    } catch (...) {
+        err = std::current_exception();
+        queue.close();
+    }
+}
+
+void bt_wf(BtQueue& queue, const String& chr)
+{
+    const bool bcf = opt::output_format == "bcf";
+    const bool cvb = opt::cvg_format == "bin";
+    String vcfout = opt::output + (bcf ? ".bcf" : ".vcf.gz");
+    String cvgout = opt::output + (cvb ? ".cvb.gz" : ".cvg.gz");
+    String splout = opt::output + ".spl.gz";
+    // chunks are bgzf blocks already, they are appended as they are
+    FILE* fov = NULL;
+    htsFile* fpb = NULL;
+    if (bcf) fpb = hts_open(vcfout.c_str(), "wb");
+    else fov = fopen(vcfout.c_str(), "wb");
+    FILE* foc = fopen(cvgout.c_str(), "wb");
+    if ((!fov && !fpb) || !foc) {
+        throw std::runtime_error("ERROR: fail to open " + vcfout + " or " + cvgout);
+    }
+    FILE* fos = NULL;
+    if (opt::sites_only && !(fos = fopen(splout.c_str(), "wb"))) {
+        throw std::runtime_error("ERROR: fail to open " + splout);
+    }
+    BGZF* fpz = bcf ? hts_get_bgzfp(fpb) : NULL;
+    bcf_hdr_t* hdr = NULL;
+    const int ifmt = bcf ? HTS_FMT_CSI : HTS_FMT_TBI;
+    hts_idx_t* iv = NULL; hts_idx_t* ic = NULL;
+    BtIdx vi, ci;
+    std::vector<CvbIdx> cvi;
+    BtChunk chunk;
+    for (size_t seq = 0; queue.pop(chunk); ++seq) {
+        if (seq == 0) {
+            if (bcf) {
+                hdr = bcf_hdr_init("r");
+                if (bcf_hdr_parse(hdr, &chunk.vcf[0]) < 0 || bcf_hdr_write(fpb, hdr) < 0) {
+                    throw std::runtime_error("ERROR: fail to write the bcf header");
+                }
+                vi.off0 = bgzf_tell(fpz);
+                // same shape as bcftools index: min_shift 14 and enough levels for the longest contig
+                int64_t max_len = 0, l;
+                vi.tid = bcf_hdr_name2id(hdr, chr.c_str());
+                vi.nids = hdr->n[BCF_DT_CTG];
+                for (int32_t c = 0; c < vi.nids; ++c) {
+                    if (hdr->id[BCF_DT_CTG][c].val && max_len < (l = hdr->id[BCF_DT_CTG][c].val->info[0])) max_len = l;
+                }
+                if (!max_len) max_len = (1LL << 31) - 1;
+                max_len += 256;
+                for (vi.n_lvls = 0, l = 1 << 14; max_len > l; ++vi.n_lvls, l <<= 3);
+            } else {
+                bt_fw(fov, chunk.vcf);
+                vi.off0 = (uint64_t)ftell(fov) << 16;
             }
-            if (bgzf_write(fpc, btr.cvg.c_str(), btr.cvg.length()) != btr.cvg.length()) {
-                throw std::runtime_error("ERROR: fail to write");
+            bt_fw(foc, chunk.cvg);
+            ci.off0 = (uint64_t)ftell(foc) << 16;
+            if (fos) bt_fw(fos, chunk.spl);
+            iv = bt_idx_init(vi, ifmt, TBX_VCF, chr);
+            if (!cvb) ic = bt_idx_init(ci, HTS_FMT_TBI, TBX_GENERIC, chr);
+            continue;
+        }
+        if (bcf) {
+            for (size_t r = 0; r < chunk.recs.size(); ++r) {
+                if (bcf_write(fpb, hdr, chunk.recs[r]) < 0) throw std::runtime_error("ERROR: fail to write");
+                bcf_destroy(chunk.recs[r]);
+                chunk.vidx.off[r] = bgzf_tell(fpz);
             }
-            aiv.clear();
-            idx.clear();
-            if (!(++count % 1000)) std::cerr << "basetype completed " << count << " sites -- thread" << ithread << std::endl;
+            chunk.vidx.tid = vi.tid;
+            bt_idx_push(iv, chunk.vidx, 0);
+        } else {
+            bt_idx_push(iv, chunk.vidx, ftell(fov));
+            bt_fw(fov, chunk.vcf);
         }
+        if (cvb && !chunk.cidx.pos.empty()) {
+            cvi.push_back({chunk.cidx.pos.front() + 1, chunk.cidx.pos.back() + 1, (uint64_t)ftell(foc) << 16});
+        } else if (!cvb) {
+            bt_idx_push(ic, chunk.cidx, ftell(foc));
+        }
+        bt_fw(foc, chunk.cvg);
+        if (fos) bt_fw(fos, chunk.spl);
     }
-    if (bgzf_close(fpv) < 0) std::cerr << "warning: file cannot be closed" << std::endl;
-    if (bgzf_close(fpc) < 0) std::cerr << "warning: file cannot be closed" << std::endl;
-    // whether remove tmp file or not
-    if (!opt::keep_tmp) {
-        for (auto & f: ftmp_v) {
-            std::remove(f.c_str());
+    if (!iv) throw std::runtime_error("ERROR: no output header");
+    hts_idx_finish(iv, bcf ? bgzf_tell(fpz) : (uint64_t)ftell(fov) << 16);
+    if (ic) hts_idx_finish(ic, (uint64_t)ftell(foc) << 16);
+    if (bcf) {
+        bcf_hdr_destroy(hdr);
+        if (hts_close(fpb) < 0) std::cerr << "warning: file cannot be closed" << std::endl;
+    } else {
+        BaseVarC::eofbgzf(fov);
+        if (fclose(fov) != 0) std::cerr << "warning: file cannot be closed" << std::endl;
+    }
+    BaseVarC::eofbgzf(foc);
+    if (fclose(foc) != 0) std::cerr << "warning: file cannot be closed" << std::endl;
+    if (fos) {
+        BaseVarC::eofbgzf(fos);
+        if (fclose(fos) != 0) std::cerr << "warning: file cannot be closed" << std::endl;
+    }
+    if (hts_idx_save(iv, vcfout.c_str(), ifmt) < 0) {
+        std::cerr << "warning: fail to write the index of " << vcfout << std::endl;
+    }
+    if (ic && hts_idx_save(ic, cvgout.c_str(), HTS_FMT_TBI) < 0) {
+        std::cerr << "warning: fail to write the index of " << cvgout << std::endl;
+    }
+    if (cvb) {
+        FILE* foi = fopen((cvgout + ".cvi").c_str(), "wb");
+        if (!foi || fwrite(CVI_MAGIC, 1, sizeof(CVI_MAGIC), foi) != sizeof(CVI_MAGIC) ||
+            fwrite(cvi.data(), sizeof(CvbIdx), cvi.size(), foi) != cvi.size()) {
+            std::cerr << "warning: fail to write the index of " << cvgout << std::endl;
         }
+        if (foi) fclose(foi);
     }
+    hts_idx_destroy(iv);
+    if (ic) hts_idx_destroy(ic);
+}
 
-    return;
+void bt_z(BtQueue& queue, size_t seq, std::shared_ptr<BtChunk> chunk)
+{
+    String gz;
+    bt_gz(chunk->vcf, gz, &chunk->vidx.off);
+    chunk->vcf.swap(gz);
+    if (!chunk->col.pos.empty()) bt_cvb(chunk->col, chunk->cvg);
+    bt_gz(chunk->cvg, gz, &chunk->cidx.off);
+    chunk->cvg.swap(gz);
+    bt_gz(chunk->spl, gz, NULL);
+    chunk->spl.swap(gz);
+    queue.push(seq, std::move(*chunk));
 }
 
-void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const String& region, const String& fout, int nb, int bc, int ib, int32_t rg_s, int thread)
+// bt_z on the gz pool, its error is only seen when bt_s has called all,
+// so the others are stopped right away
+void bt_zp(BtCtx& x, size_t seq, std::shared_ptr<BtChunk> chunk)
 {
-    PosAlleleMapVec allele_mv;
-    String names, fw;
-    StringV::const_iterator itb = bams.begin() + ib * bc, itb2;
-    if (ib == nb - 1) {
-        itb2 = bams.end();
-    } else {
-        itb2 = bams.begin() + (ib + 1) * bc;
+    try {
+        bt_z(x.queue, seq, chunk);
+    } catch (...) {
+        bt_fail(x);
+        throw;
     }
-    int32_t size = itb2 - itb, count = 0;
-    allele_mv.reserve(size);
-    for (; itb != itb2; ++itb) {
-        auto bam = *itb;
-        BamProcess reader(opt::mapq);
-        if (!(++count % 100)) std::cerr << "reading the number " << count << " bam -- " << fout << ".tmp.batch." << ib << std::endl;
-        if (!reader.Open(bam)) {
-            throw std::runtime_error("ERROR: can not open file " + bam);
+}
+
+void bt_gz(const String& in, String& out, std::vector<uint64_t>* off)
+{
+    // whole bgzf blocks of the text, off holds the end of records in the
+    // text and gets their virtual offsets relative to out
+    std::vector<uint64_t> addr{0};
+    std::vector<char> blk(BGZF_MAX_BLOCK_SIZE);
+    size_t len, dlen;
+    out.clear();
+    for (size_t u = 0; u < in.length(); u += BGZF_BLOCK_SIZE) {
+        len = std::min<size_t>(BGZF_BLOCK_SIZE, in.length() - u);
+        dlen = blk.size();
+        if (bgzf_compress(blk.data(), &dlen, in.data() + u, len, -1) < 0) {
+            throw std::runtime_error("ERROR: fail to compress");
         }
-        if (!reader.FindSnpAtPos(rg_s, refseq, region, pv)) {
-            std::cerr << "warning: " << reader.sm << " region " << region << " is empty." << std::endl;
+        out.append(blk.data(), dlen);
+        addr.push_back(out.length());
+    }
+    if (!off) return;
+    for (auto & o : *off) o = addr[o / BGZF_BLOCK_SIZE] << 16 | o % BGZF_BLOCK_SIZE;
+}
+
+void bt_fw(FILE* fp, const String& s)
+{
+    if (fwrite(s.data(), 1, s.length(), fp) != s.length()) {
+        throw std::runtime_error("ERROR: fail to write");
+    }
+}
+
+void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const String& region, const String& fout, int nb, int bc, int first, int32_t rg_s, int thread, BaseVarC::TaskScheduler& sched, hts_tpool* io_pool)
+{
+    // one task per bam. as many batches as workers are open at a time, the
+    // last bam read of a batch writes its tmp files
+    BrCtx x(bams, pv, refseq, region, fout, rg_s, bc, first, thread, io_pool);
+    BaseVarC::TaskGroup group;
+    const int most = sched.size();
+    const int32_t N = bams.size();
+    x.batches.resize(nb - first);
+    for (int ib = first; ib < nb; ++ib) {
+        {
+            std::unique_lock<std::mutex> lock(x.m);
+            x.cv.wait(lock, [&x, most]{ return x.open < most; });
+            if (x.fail) break;
+            ++x.open;
         }
-        allele_mv.push_back(reader.allele_m);
-        names += reader.sm + '\t';
-        if (!reader.Close()) {
-            std::cerr << "warning: could not close " << bam << std::endl;
+        BrBatch* b = new BrBatch;
+        b->ib = ib;
+        b->b = ib * bc;
+        b->e = ib == nb - 1 ? N : (ib + 1) * bc;
+        b->allele_mv.resize(b->e - b->b);
+        b->names.resize(b->e - b->b);
+        b->left = b->e - b->b;
+        b->count = 0;
+        b->bad = false;
+        x.batches[ib - first].reset(b);
+        for (int32_t k = b->b; k < b->e; ++k) sched.submit(group, bt_rb, &x, k);
+    }
+    group.wait();
+
+    return;
+}
+
+void bt_rb(void* ctx, size_t k)
+{
+    BrCtx& x = *static_cast<BrCtx*>(ctx);
+    BrBatch& b = *x.batches[k / x.bc - x.first];
+    try {
+        // the rest of a failed batch is skipped
+        if (!b.bad) {
+            auto const& bam = x.bams[k];
+            BamProcess reader(opt::mapq);
+            if (!(++b.count % 100)) std::cerr << "reading the number " << b.count << " bam -- " << x.fout << ".tmp.batch." << b.ib << std::endl;
+            if (!reader.Open(bam)) {
+                throw std::runtime_error("ERROR: can not open file " + bam);
+            }
+            if (!reader.FindSnpAtPos(x.rg_s, x.refseq, x.region, x.pv)) {
+                std::cerr << "warning: " << reader.sm << " region " << x.region << " is empty." << std::endl;
+            }
+            b.allele_mv[k - b.b] = std::move(reader.allele_m);
+            b.names[k - b.b] = reader.sm;
+            if (!reader.Close()) {
+                std::cerr << "warning: could not close " << bam << std::endl;
+            }
         }
+    } catch (...) {
+        b.bad = true;
+        bt_rd(x, b);
+        throw;
     }
+    bt_rd(x, b);
+}
+
+void bt_rd(BrCtx& x, BrBatch& b)
+{
+    if (--b.left > 0) return;
+    std::exception_ptr e;
+    if (!b.bad) {
+        try {
+            bt_rw(x, b);
+        } catch (...) {
+            e = std::current_exception();
+        }
+    }
+    PosAlleleMapVec().swap(b.allele_mv);
+    {
+        std::lock_guard<std::mutex> lock(x.m);
+        --x.open;
+        if (b.bad || e) x.fail = true;
+    }
+    x.cv.notify_all();
+    if (e) std::rethrow_exception(e);
+}
+
+void bt_rw(BrCtx& x, BrBatch& b)
+{
+    String names, fw;
+    for (auto & sm : b.names) names += sm + '\t';
     names += "\n";    // we keep '\t' ahead of '\n' in order to connect different batches' names directly
-    int32_t psize = pv.size();
-    int32_t window = psize % thread + psize / thread;
+    int32_t psize = x.pv.size();
+    names = bt_tag(x.thread, x.bc, psize) + "\n" + names;
     std::vector<BGZF*> fpv;
     BGZF* fp;
-    for (int i = 0; i < thread; ++i) {
-        fw = fmt::format("{}.tmp.thread.{}/batch.{}", fout, i, ib);
+    for (int i = 0; i < x.thread; ++i) {
+        fw = fmt::format("{}.tmp.thread.{}/batch.{}", x.fout, i, b.ib);
         fp = bgzf_open(fw.c_str(), "w");
+        if (!fp) throw std::runtime_error("ERROR: fail to open " + fw);
+        if (x.io_pool) bgzf_thread_pool(fp, x.io_pool, 0);
         if (bgzf_write(fp, names.c_str(), names.length()) != names.length()) {
             throw std::runtime_error("ERROR: fail to write");
         }
@@ -508,9 +1303,9 @@ void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const Strin
 
     String out;
     for (int i = 0, j = 0; i < psize; ++i) {
-        auto p = pv[i];
+        auto p = x.pv[i];
         out = "";
-        for (auto const& m : allele_mv) {
+        for (auto const& m : b.allele_mv) {
             if (m.count(p)) {
                 auto const& a = m.at(p);
                 if (a.is_indel == 1) out += fmt::format("{} ", a.indel);
@@ -520,7 +1315,7 @@ void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const Strin
             }
         }
         out += "\n";
-        if (i == (j + 1) * window) ++j;
+        j = (i / BT_CHUNK) % x.thread;    // chunks of positions go round-robin
         if (bgzf_write(fpv[j], out.c_str(), out.length()) != out.length()) {
             throw std::runtime_error("ERROR: fail to write");
         }
@@ -533,147 +1328,501 @@ void bt_r(const StringV& bams, const IntV& pv, const String& refseq, const Strin
     return;
 }
 
-BtRes bt_f(int32_t p, const GroupIdx& popg_idx, const AlleleInfoVector& aiv, const DepM& idx, int32_t N, const String& chr, int32_t rg_s, const String& refseq)
+String bt_tag(int thread, int bc, int64_t psize)
+{
+    return fmt::format("{}\t{}\t{}\t{}\t{}", BT_TMP_TAG, BT_CHUNK, thread, bc, psize);
+}
+
+// reads the first line of a tmp file, whether it is the tag
+bool bt_tagged(BGZF* fp, const String& tag, kstring_t* ks)
+{
+    return bgzf_getline(fp, '\n', ks) >= 0 && tag == ks->s;
+}
+
+double bt_minaf(int32_t N)
 {
-    int8_t alt_base, ref_base;
-    int32_t dep, na, nc, ng, nt, ref_fwd, ref_rev, alt_fwd, alt_rev;
-    double fs, sor;
     double min_af = 100.0 / N;
     if (min_af > 0.001) min_af = 0.001;
     if (opt::maf < min_af ) min_af = opt::maf;
+    return min_af;
+}
+
+hts_idx_t* bt_idx_init(const BtIdx& bi, int fmt, int preset, const String& chr)
+{
+    hts_idx_t* idx;
+    if (fmt == HTS_FMT_CSI) {
+        idx = hts_idx_init(bi.nids, fmt, bi.off0, 14, bi.n_lvls);
+    } else {
+        idx = hts_idx_init(0, fmt, bi.off0, 14, 5);
+    }
+    if (!idx) throw std::runtime_error("ERROR: fail to init the index");
+    if (fmt != HTS_FMT_TBI) return idx;
+    // tabix meta: the column layout followed by the contig names. vcf and
+    // cvg both have CHROM and POS in the first two columns
+    tbx_conf_t conf = tbx_conf_vcf;
+    conf.preset = preset;
+    int32_t x[7] = {conf.preset, conf.sc, conf.bc, conf.ec, conf.meta_char, conf.line_skip, (int32_t)chr.length() + 1};
+    std::vector<uint8_t> meta(sizeof(x) + chr.length() + 1, 0);
+    memcpy(meta.data(), x, sizeof(x));
+    memcpy(meta.data() + sizeof(x), chr.c_str(), chr.length());
+    hts_idx_set_meta(idx, meta.size(), meta.data(), 1);
+    return idx;
+}
+
+void bt_idx_push(hts_idx_t* idx, const BtIdx& bi, uint64_t coff)
+{
+    for (size_t i = 0; i < bi.pos.size(); ++i) {
+        if (hts_idx_push(idx, bi.tid, bi.pos[i], bi.pos[i] + 1, (coff << 16) + bi.off[i], 1) < 0) {
+            throw std::runtime_error("ERROR: fail to index the record at " + BaseVarC::tostring(bi.pos[i] + 1));
+        }
+    }
+}
+
+// the BaseType of site is built in bts and left there for bt_f
+bool bt_lrt(const BtSite& site, int32_t N, int32_t rg_s, const String& refseq, LrtCache& cache, std::vector<BaseType>& bts)
+{
+    const double min_af = bt_minaf(N);
     BaseV bases, quals;
-    BtRes res;
-    IndelMap indel_m;
-    // output cvg;
-    ref_base = BASE_INT8_TABLE[static_cast<size_t>(refseq[p - rg_s])];
-    na = 0; nc = 0; ng = 0; nt = 0;
-    for (auto const& a: aiv) {
+    for (auto const& a: site.aiv) {
         if (a.is_indel == 0) {
-            switch (a.base) {
-            case 0 : na += 1; break;
-            case 1 : nc += 1; break;
-            case 2 : ng += 1; break;
-            case 3 : nt += 1; break;
-            }
             bases.push_back(a.base);
             quals.push_back(a.qual);
-        } else if (a.is_indel == 1) {
-            if (indel_m.count(a.indel)) {
-                indel_m[a.indel] += 1;
-            } else {
-                indel_m.insert({a.indel, 1});
-            }
         }
     }
-    String oss, indels = ".";
-    if (!indel_m.empty()) {
-        indels = "";
-        for (IndelMap::iterator it = indel_m.begin(); it != indel_m.end(); ++it) {
-            indels += fmt::format("{}|{},", it->first, it->second);
+    bts.clear();
+    bts.emplace_back(bases, quals, BASE_INT8_TABLE[static_cast<size_t>(refseq[site.p - rg_s])], min_af);
+    return cache.LRT(bts.back());
+}
+
+void bt_sum(const BtSite& site, const IntV& sam_grp, int32_t ngroup, int8_t ref_base, const BaseType& bt, bool bt_success, SiteSum& sum)
+{
+    int32_t g;
+    bool is_alt[8] = {false};
+    for (auto b : bt.alt_bases) is_alt[b] = true;
+    std::fill(sum.depth, sum.depth + NTYPE, 0);
+    std::fill(&sum.strand[0][0], &sum.strand[0][0] + 16, 0);
+    sum.indel_m = IndelMap();    // a fresh map keeps the output order of indels
+    sum.gr_depth.assign(ngroup * NTYPE, 0);
+    sum.gr_rows.resize(ngroup);
+    for (g = 0; g < ngroup; ++g) {
+        sum.gr_rows[g].clear();
+    }
+    if (bt_success) {
+        sum.st = Stat();
+        for (auto h : {sum.ref_quals, sum.ref_mapqs, sum.ref_rprs, sum.alt_quals, sum.alt_mapqs, sum.alt_rprs}) {
+            std::fill(h, h + RANK_BINS, 0);
+        }
+    }
+    int32_t row = 0;    // read of a in bt, which holds the non-indel entries
+    for (size_t i = 0; i < site.aiv.size(); ++i) {
+        auto const& a = site.aiv[i];
+        // indels keep the base of the previous entry, the cvg strand table
+        // has always counted them that way
+        sum.strand[a.base][a.strand] += 1;
+        if (a.is_indel == 1) {
+            sum.indel_m[a.indel] += 1;
+            continue;
+        }
+        row++;
+        if (a.base == 4) continue;
+        sum.depth[a.base] += 1;
+        g = sam_grp[site.sam[i]];
+        if (g >= 0) {
+            sum.gr_depth[g * NTYPE + a.base] += 1;
+            if (bt_success) sum.gr_rows[g].push_back(row - 1);
+        }
+        if (!bt_success) continue;
+        if (a.base == ref_base) {
+            sum.ref_quals[a.qual]++;
+            sum.ref_mapqs[a.mapq]++;
+            sum.ref_rprs[a.rpr]++;
+            if (a.strand == 1) sum.st.ref_fwd += 1;
+            else sum.st.ref_rev += 1;
+        } else if (is_alt[a.base]) {
+            sum.alt_quals[a.qual]++;
+            sum.alt_mapqs[a.mapq]++;
+            sum.alt_rprs[a.rpr]++;
+            if (a.strand == 1) sum.st.alt_fwd += 1;
+            else sum.st.alt_rev += 1;
         }
-        indels.pop_back();
     }
-    IntV tmp = {na, nc, ng, nt};
-    std::vector<size_t> didx = BaseVarC::sortidx(tmp);
+}
+
+void bt_f(const BtSite& site, const StringV& groups, const IntV& sam_grp, const IntV& info_order, int32_t N, const String& chr, int32_t rg_s, const String& refseq, BaseType& bt, bool bt_success, LrtCache& cache, FisherCache& fisher, SiteSum& sum, bcf_hdr_t* hdr, bcf1_t* rec, BtRes& res)
+{
+    const int32_t p = site.p;
+    int8_t alt_base = 0, ref_base;
+    int32_t dep;
+    // res is reused by the caller, records are appended to its buffers.
+    // the columnar cvg is taken from sum by the caller instead
+    const bool cvg_txt = opt::cvg_format != "bin";
+    res.cvg.clear();
+    res.vcf.clear();
+    res.em_iter = 0;
+    auto oss = std::back_inserter(res.cvg);
+    // output cvg;
+    ref_base = BASE_INT8_TABLE[static_cast<size_t>(refseq[p - rg_s])];
+    bt_sum(site, sam_grp, groups.size(), ref_base, bt, bt_success, sum);
+    size_t didx[NTYPE] = {0, 1, 2, 3};
+    std::sort(didx, didx + NTYPE, [&sum](size_t i1, size_t i2) {return sum.depth[i1] > sum.depth[i2];});
+    Stat& sb = sum.sb;
+    sb = Stat();
     if (ref_base >= 0) {
         if (didx[0] != (unsigned)ref_base) {  // cast to unsigned type to avoid -Wsign-compare warning
             alt_base = didx[0];
         } else{
             alt_base = didx[1];
         }
+        sb.ref_fwd = sum.strand[ref_base][1];
+        sb.ref_rev = sum.strand[ref_base][0];
+        sb.alt_fwd = sum.strand[alt_base][1];
+        sb.alt_rev = sum.strand[alt_base][0];
     } else {
         std::cerr << "warning: the reference base is not one of {ACGT and will be skipped.}"<< std::endl;
     }
-    ref_fwd = 0, ref_rev = 0, alt_fwd = 0, alt_rev = 0;
-    for (auto const& a: aiv) {
-        if (a.strand == 1) {
-            if (a.base == ref_base) {
-                ref_fwd += 1;
-            } else if (a.base == alt_base) {
-                alt_fwd += 1;
-            }
-        } else if (a.strand == 0) {
-            if (a.base == ref_base) {
-                ref_rev += 1;
-            } else if (a.base == alt_base) {
-                alt_rev += 1;
-            }
+    StrandBias(sb, fisher);
+    dep = sum.depth[0] + sum.depth[1] + sum.depth[2] + sum.depth[3];
+    if (cvg_txt) {
+        fmt::format_to(oss, "{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t", chr, p, BASE2CHAR[ref_base], dep, sum.depth[0], sum.depth[1], sum.depth[2], sum.depth[3]);
+        if (sum.indel_m.empty()) res.cvg += '.';
+        for (IndelMap::iterator it = sum.indel_m.begin(); it != sum.indel_m.end(); ++it) {
+            if (it != sum.indel_m.begin()) res.cvg += ',';
+            fmt::format_to(oss, "{}|{}", it->first, it->second);
         }
+        fmt::format_to(oss, "\t{:.3f}\t{:.3f}\t{},{},{},{}", sb.fs, sb.sor, sb.ref_fwd, sb.ref_rev, sb.alt_fwd, sb.alt_rev);
     }
-    fs = bt_fisher_exact(ref_fwd, ref_rev, alt_fwd, alt_rev);
-    if (alt_fwd * ref_rev > 0) {
-        sor = static_cast<double>(ref_fwd * alt_rev) / (ref_rev * alt_fwd);
-    } else {
-        sor = 10000.0;
-    }
-    dep = na + nc + ng + nt;
-    oss = fmt::format("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{:.3f}\t{:.3f}\t{},{},{},{}\t", chr, p, BASE2CHAR[ref_base], dep, na, nc, ng, nt, indels, fs, sor, ref_fwd, ref_rev, alt_fwd, alt_rev);
     // basetype caller;
-    BaseType bt(bases, quals, ref_base, min_af);
-    const bool bt_success = bt.LRT();
+    res.em_iter += bt.em_iter;
     BaseV base_comb{ref_base};
     base_comb.insert(base_comb.end(), bt.alt_bases.begin(), bt.alt_bases.end());
     // popgroup depth
-    InfoM info;
-    if (!popg_idx.empty()) {
-        BaseV gr_bases, gr_quals;
-        String gr_af;
-        for (GroupIdx::const_iterator it = popg_idx.begin(); it != popg_idx.end(); ++it) {
-            na = 0; nc = 0; ng = 0; nt = 0;
-            for (auto i : it->second) {
-                if (idx.count(i)) {
-                    auto & a = aiv[idx.at(i)];
-                    if (a.is_indel == 0) {
-                        switch (a.base) {
-                        case 0 : na += 1; break;
-                        case 1 : nc += 1; break;
-                        case 2 : ng += 1; break;
-                        case 3 : nt += 1; break;
-                        }
-                        if (bt_success) {
-                            gr_bases.push_back(a.base);
-                            gr_quals.push_back(a.qual);
-                        }
-                    }
-                }
+    sum.gr_af.resize(groups.size());
+    sum.gr_str.resize(groups.size());
+    // groups are views on bt sharing its likelihoods
+    std::vector<BaseType> gr_bts;
+    std::vector<bool> gr_success;
+    gr_bts.reserve(groups.size());
+    for (size_t g = 0; g < groups.size(); ++g) {
+        if (sum.gr_rows[g].empty()) continue;
+        gr_bts.emplace_back(bt, sum.gr_rows[g]);
+        gr_bts.back().SetBase(base_comb);
+        gr_success.push_back(cache.LRT(gr_bts.back()));
+    }
+    size_t r = 0;
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const int32_t* d = &sum.gr_depth[g * NTYPE];
+        if (cvg_txt) fmt::format_to(oss, "\t{}:{}:{}:{}", d[0], d[1], d[2], d[3]);
+        auto & af = sum.gr_af[g];
+        auto & gr_af = sum.gr_str[g];
+        af.assign(bt.alt_bases.size(), 0.0);
+        gr_af.clear();
+        if (!sum.gr_rows[g].empty()) {
+            BaseType& gr_bt = gr_bts[r++];
+            res.em_iter += gr_bt.em_iter;
+            for (size_t i = 0; i < bt.alt_bases.size(); ++i) {
+                auto f = gr_bt.af_lrt.find(bt.alt_bases[i]);
+                if (f != gr_bt.af_lrt.end()) af[i] = f->second;
+                if (hdr) continue;
+                if (i > 0) gr_af += ',';
+                if (f != gr_bt.af_lrt.end()) fmt::format_to(std::back_inserter(gr_af), "{:.6f}", f->second);
+                else gr_af += '0';
             }
-            oss += fmt::format("{}:{}:{}:{}\t", na, nc, ng, nt);
-            if (!gr_bases.empty()) {
-                BaseType gr_bt(gr_bases, gr_quals, ref_base, min_af);
-                gr_bt.SetBase(base_comb);
-                gr_bt.LRT();
-                gr_af = "";
-                for (auto b : bt.alt_bases) {
-                    if (gr_bt.af_lrt.count(b)) {
-                        gr_af += fmt::format("{:.6f},", gr_bt.af_lrt[b]);
-                    } else {
-                        gr_af += "0,";
-                    }
-                }
-                gr_af.pop_back();
-                gr_bases.clear();
-                gr_quals.clear();
-                info.insert({it->first + "_AF", gr_af});
-            } else {
-                info.insert({it->first + "_AF", "0"});
+        } else {
+            gr_af = "0";
+        }
+    }
+    if (cvg_txt) res.cvg += '\n';
+    // sites only output has no sample columns, genotypes go to the .spl.gz
+    const int32_t ncol = opt::sites_only ? 0 : N;
+    if (bt_success && hdr) {
+        WriteBcf(bt, hdr, rec, chr, p, ref_base, site.aiv, site.sam, groups, ncol, sum, fisher);
+    } else if (bt_success) {
+        WriteVcf(res.vcf, bt, chr, p, ref_base, site.aiv, site.sam, info_order, groups, ncol, sum, fisher);
+    }
+}
+
+void bt_spl(const BtSite& site, String& out)
+{
+    const int32_t n = site.sam.size();
+    out.clear();
+    out.append((const char*)&site.p, sizeof(site.p));
+    out.append((const char*)&n, sizeof(n));
+    out.append((const char*)site.sam.data(), n * sizeof(int32_t));
+    for (auto const& a : site.aiv) out += (char)a.base;
+    for (auto const& a : site.aiv) out += (char)a.strand;
+    for (auto const& a : site.aiv) out += (char)a.qual;
+}
+
+bool bt_spl_read(BGZF* fp, BtSite& site)
+{
+    int32_t h[2];
+    ssize_t l = bgzf_read(fp, h, sizeof(h));
+    if (l == 0) return false;
+    if (l != sizeof(h) || h[1] < 0) throw std::runtime_error("ERROR: truncated sparse genotypes record");
+    const int32_t n = h[1];
+    site.p = h[0];
+    site.sam.resize(n);
+    site.aiv.resize(n);
+    std::vector<uint8_t> buf(3 * n);
+    if (bgzf_read(fp, site.sam.data(), n * sizeof(int32_t)) != (ssize_t)(n * sizeof(int32_t)) ||
+        bgzf_read(fp, buf.data(), buf.size()) != (ssize_t)buf.size()) {
+        throw std::runtime_error("ERROR: truncated sparse genotypes record at " + BaseVarC::tostring(site.p));
+    }
+    for (int32_t i = 0; i < n; ++i) {
+        site.aiv[i].base = buf[i];
+        site.aiv[i].strand = buf[n + i];
+        site.aiv[i].qual = buf[2 * n + i];
+    }
+    return true;
+}
+
+void bt_cvb_push(CvbBlock& b, int32_t p, char ref, const SiteSum& sum)
+{
+    const int32_t st[4] = {sum.sb.ref_fwd, sum.sb.ref_rev, sum.sb.alt_fwd, sum.sb.alt_rev};
+    b.pos.push_back(p);
+    b.ref += ref;
+    for (int i = 0; i < NTYPE; ++i) b.depth[i].push_back(sum.depth[i]);
+    for (int i = 0; i < 4; ++i) b.strand[i].push_back(st[i]);
+    b.fs.push_back(sum.sb.fs);
+    b.sor.push_back(sum.sb.sor);
+    b.gr_depth.resize(sum.gr_depth.size());
+    for (size_t i = 0; i < sum.gr_depth.size(); ++i) b.gr_depth[i].push_back(sum.gr_depth[i]);
+    if (sum.indel_m.empty()) b.indel += '.';
+    for (IndelMap::const_iterator it = sum.indel_m.begin(); it != sum.indel_m.end(); ++it) {
+        if (it != sum.indel_m.begin()) b.indel += ',';
+        fmt::format_to(std::back_inserter(b.indel), "{}|{}", it->first, it->second);
+    }
+    b.indel_end.push_back(b.indel.length());
+}
+
+void bt_cvb_cat(CvbBlock& a, const CvbBlock& b)
+{
+    const int32_t l = a.indel.length();
+    a.pos.insert(a.pos.end(), b.pos.begin(), b.pos.end());
+    a.ref += b.ref;
+    for (int i = 0; i < NTYPE; ++i) a.depth[i].insert(a.depth[i].end(), b.depth[i].begin(), b.depth[i].end());
+    for (int i = 0; i < 4; ++i) a.strand[i].insert(a.strand[i].end(), b.strand[i].begin(), b.strand[i].end());
+    a.fs.insert(a.fs.end(), b.fs.begin(), b.fs.end());
+    a.sor.insert(a.sor.end(), b.sor.begin(), b.sor.end());
+    a.gr_depth.resize(b.gr_depth.size());
+    for (size_t i = 0; i < b.gr_depth.size(); ++i) a.gr_depth[i].insert(a.gr_depth[i].end(), b.gr_depth[i].begin(), b.gr_depth[i].end());
+    for (auto e : b.indel_end) a.indel_end.push_back(e + l);
+    a.indel += b.indel;
+}
+
+template<typename T>
+inline void bt_put(String& out, const std::vector<T>& v)
+{
+    out.append((const char*)v.data(), v.size() * sizeof(T));
+}
+
+template<typename T>
+inline bool bt_get(BGZF* fp, std::vector<T>& v, size_t n)
+{
+    v.resize(n);
+    return bgzf_read(fp, v.data(), n * sizeof(T)) == (ssize_t)(n * sizeof(T));
+}
+
+void bt_cvb(const CvbBlock& b, String& out)
+{
+    const int32_t h[2] = {(int32_t)b.pos.size(), (int32_t)b.gr_depth.size()};
+    out.append((const char*)h, sizeof(h));
+    bt_put(out, b.pos);
+    out += b.ref;
+    for (auto & v : b.depth) bt_put(out, v);
+    for (auto & v : b.strand) bt_put(out, v);
+    bt_put(out, b.fs);
+    bt_put(out, b.sor);
+    for (auto & v : b.gr_depth) bt_put(out, v);
+    bt_put(out, b.indel_end);
+    out += b.indel;
+}
+
+bool bt_cvb_read(BGZF* fp, CvbBlock& b)
+{
+    int32_t h[2];
+    ssize_t l = bgzf_read(fp, h, sizeof(h));
+    if (l == 0) return false;
+    if (l != sizeof(h) || h[0] < 0 || h[1] < 0) throw std::runtime_error("ERROR: truncated cvg block");
+    const size_t n = h[0];
+    bool ok = bt_get(fp, b.pos, n);
+    b.ref.resize(n);
+    ok = ok && bgzf_read(fp, &b.ref[0], n) == (ssize_t)n;
+    for (auto & v : b.depth) ok = ok && bt_get(fp, v, n);
+    for (auto & v : b.strand) ok = ok && bt_get(fp, v, n);
+    ok = ok && bt_get(fp, b.fs, n) && bt_get(fp, b.sor, n);
+    b.gr_depth.resize(h[1]);
+    for (auto & v : b.gr_depth) ok = ok && bt_get(fp, v, n);
+    ok = ok && bt_get(fp, b.indel_end, n);
+    b.indel.resize(n ? b.indel_end.back() : 0);
+    ok = ok && bgzf_read(fp, &b.indel[0], b.indel.length()) == (ssize_t)b.indel.length();
+    if (!ok) throw std::runtime_error("ERROR: truncated cvg block");
+    return true;
+}
+
+void bt_cvb_text(const CvbBlock& b, size_t i, const String& chr, String& out)
+{
+    auto oss = std::back_inserter(out);
+    const int32_t dep = b.depth[0][i] + b.depth[1][i] + b.depth[2][i] + b.depth[3][i];
+    const int32_t ib = i ? b.indel_end[i - 1] : 0;
+    fmt::format_to(oss, "{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t", chr, b.pos[i], b.ref[i], dep, b.depth[0][i], b.depth[1][i], b.depth[2][i], b.depth[3][i]);
+    out.append(b.indel, ib, b.indel_end[i] - ib);
+    fmt::format_to(oss, "\t{:.3f}\t{:.3f}\t{},{},{},{}", b.fs[i], b.sor[i], b.strand[0][i], b.strand[1][i], b.strand[2][i], b.strand[3][i]);
+    for (size_t g = 0; g < b.gr_depth.size(); g += NTYPE) {
+        fmt::format_to(oss, "\t{}:{}:{}:{}", b.gr_depth[g][i], b.gr_depth[g + 1][i], b.gr_depth[g + 2][i], b.gr_depth[g + 3][i]);
+    }
+    out += '\n';
+}
+
+void runCvgView(int argc, char **argv)
+{
+    parseOptions(argc, argv, CVGVIEW_MESSAGE);
+    String cvbin = opt::input + ".cvb.gz";
+    BGZF* fi = bgzf_open(cvbin.c_str(), "r");
+    if (!fi) {
+        throw std::runtime_error("ERROR: fail to open " + cvbin);
+    }
+    char magic[sizeof(CVB_MAGIC)];
+    int32_t l;
+    if (bgzf_read(fi, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, CVB_MAGIC, sizeof(magic))) {
+        throw std::runtime_error("ERROR: " + cvbin + " is not a columnar cvg file");
+    }
+    if (bgzf_read(fi, &l, sizeof(l)) != sizeof(l) || l < 0) {
+        throw std::runtime_error("ERROR: truncated header of " + cvbin);
+    }
+    String names(l, '\0');
+    if (bgzf_read(fi, &names[0], l) != l) {
+        throw std::runtime_error("ERROR: truncated header of " + cvbin);
+    }
+    size_t t = names.find('\t');
+    String chr = names.substr(0, t);
+    String out = String(CVG_HEADER);
+    if (t != String::npos) out += names.substr(t);
+    out += "\n";
+    // sites of the region only, its blocks are found by the .cvi index
+    std::vector<CvbIdx> blks;
+    String rchr = chr;
+    int32_t rg_s = 0, rg_e = INT32_MAX - 1;
+    if (!opt::region.empty()) {
+        std::tie(rchr, rg_s, rg_e) = BaseVarC::splitrg(opt::region);
+        String cvi = cvbin + ".cvi";
+        FILE* fx = fopen(cvi.c_str(), "rb");
+        if (!fx || fread(magic, 1, sizeof(magic), fx) != sizeof(magic) || memcmp(magic, CVI_MAGIC, sizeof(magic))) {
+            throw std::runtime_error("ERROR: fail to load the index " + cvi);
+        }
+        for (CvbIdx x; fread(&x, sizeof(x), 1, fx) == 1;) blks.push_back(x);
+        fclose(fx);
+    }
+    const bool plain = opt::output == "-";
+    String cvgout = plain ? opt::output : opt::output + ".cvg.gz";
+    BGZF* fo = bgzf_open(cvgout.c_str(), plain ? "wu" : "w");
+    if (!fo) {
+        throw std::runtime_error("ERROR: fail to open " + cvgout);
+    }
+    CvbBlock b;
+    size_t k = 0;
+    int32_t count = 0;
+    while (rchr == chr) {
+        if (!opt::region.empty()) {
+            while (k < blks.size() && blks[k].end < rg_s) ++k;
+            if (k == blks.size() || blks[k].beg > rg_e + 1) break;
+            if (bgzf_seek(fi, blks[k++].off, SEEK_SET) < 0) {
+                throw std::runtime_error("ERROR: fail to seek in " + cvbin);
             }
         }
+        if (!bt_cvb_read(fi, b)) break;
+        for (size_t i = 0; i < b.pos.size(); ++i) {
+            if (b.pos[i] < rg_s || b.pos[i] > rg_e + 1) continue;
+            bt_cvb_text(b, i, chr, out);
+            count++;
+        }
+        if (bgzf_write(fo, out.c_str(), out.length()) != (ssize_t)out.length()) {
+            throw std::runtime_error("ERROR: fail to write");
+        }
+        out.clear();
     }
-    oss.pop_back(); oss += "\n";
-    res.cvg = oss;
-    if (bt_success) {
-        res.vcf = WriteVcf(bt, chr, p, ref_base, aiv, idx, info, N);
+    if (!out.empty() && bgzf_write(fo, out.c_str(), out.length()) != (ssize_t)out.length()) {
+        throw std::runtime_error("ERROR: fail to write");
+    }
+    bgzf_close(fi);
+    if (bgzf_close(fo) < 0) std::cerr << "warning: fail to close file" << std::endl;
+    std::cerr << "cvgview done, " << count << " sites" << std::endl;
+
+    return;
+}
+
+void runExpand(int argc, char **argv)
+{
+    parseOptions(argc, argv, EXPAND_MESSAGE);
+    String vcfin = opt::input + ".vcf.gz";
+    String splin = opt::input + ".spl.gz";
+    String vcfout = opt::output + ".vcf.gz";
+    BGZF* fiv = bgzf_open(vcfin.c_str(), "r");
+    BGZF* fis = bgzf_open(splin.c_str(), "r");
+    if (!fiv || !fis) {
+        throw std::runtime_error("ERROR: fail to open " + vcfin + " or " + splin);
     }
+    char magic[sizeof(SPL_MAGIC)];
+    int32_t N, l;
+    if (bgzf_read(fis, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, SPL_MAGIC, sizeof(magic))) {
+        throw std::runtime_error("ERROR: " + splin + " is not a sparse genotypes file");
+    }
+    if (bgzf_read(fis, &N, sizeof(N)) != sizeof(N) || bgzf_read(fis, &l, sizeof(l)) != sizeof(l)) {
+        throw std::runtime_error("ERROR: truncated header of " + splin);
+    }
+    String sams(l, '\0');
+    if (bgzf_read(fis, &sams[0], l) != l) {
+        throw std::runtime_error("ERROR: truncated header of " + splin);
+    }
+    BGZF* fov = bgzf_open(vcfout.c_str(), "w");
+    kstring_t ks = {0, 0, NULL};
+    String out;
+    BtSite site;
+    BaseV alt_bases;
+    int32_t count = 0;
+    while (bgzf_getline(fiv, '\n', &ks) >= 0) {
+        out = ks.s;
+        if (out.compare(0, 6, "#CHROM") == 0) {
+            out += "\tFORMAT\t" + sams;
+        } else if (out[0] != '#') {
+            // REF and ALT are the 4th and 5th columns, all single bases
+            size_t b = 0;
+            for (int c = 0; c < 3; ++c) b = out.find('\t', b) + 1;
+            const int8_t ref_base = BASE_INT8_TABLE[static_cast<size_t>(out[b])];
+            alt_bases.clear();
+            for (size_t i = b + 2; i < out.length() && out[i] != '\t'; i += 2) {
+                alt_bases.push_back(BASE_INT8_TABLE[static_cast<size_t>(out[i])]);
+            }
+            if (!bt_spl_read(fis, site) || site.p != std::stoi(out.substr(out.find('\t') + 1))) {
+                throw std::runtime_error("ERROR: " + splin + " does not match the sites of " + vcfin);
+            }
+            out += "\tGT:AB:SO:BP\t";
+            SampleColumns(out, alt_bases, ref_base, site.aiv, site.sam, N);
+            if (!(++count % 10000)) std::cerr << "expanded " << count << " sites" << std::endl;
+        }
+        out += "\n";
+        if (bgzf_write(fov, out.c_str(), out.length()) != out.length()) {
+            throw std::runtime_error("ERROR: fail to write");
+        }
+    }
+    free(ks.s);
+    bgzf_close(fiv);
+    bgzf_close(fis);
+    if (bgzf_close(fov) < 0) std::cerr << "warning: fail to close file" << std::endl;
+    std::cout << "expand done" << std::endl;
 
-    return res;
+    return;
 }
 
 void runPopMatrix (int argc, char **argv)
 {
     parseOptions(argc, argv, POPMATRIX_MESSAGE);
-    if (opt::reference.empty() || opt::posfile.empty()) {
+    if (opt::posfile.empty()) {
         throw std::invalid_argument(POPMATRIX_MESSAGE);
     }
+    if (opt::matrix_format != "txt" && opt::matrix_format != "bin") {
+        throw std::invalid_argument("matrix format must be txt or bin");
+    }
     std::cerr << "popmatrix start" << std::endl;
     clock_t ctb = clock();
     std::ifstream ibam(opt::input);
@@ -689,36 +1838,63 @@ void runPopMatrix (int argc, char **argv)
 
     const int32_t N = bams.size();
     const int32_t M = pv.size();
-    String out = fmt::format("{}\t{}\n", N, M);
+    String out;
+    if (opt::matrix_format == "bin") {
+        String sites;
+        for (auto const& p : pv) fmt::format_to(std::back_inserter(sites), "{}\t{}\t{}\t{}\n", p.chr, p.pos, p.ref, p.alt);
+        const int32_t h[3] = {N, M, (int32_t)sites.length()};
+        out.assign(PMB_MAGIC, sizeof(PMB_MAGIC));
+        out.append((const char*)h, sizeof(h));
+        out += sites;
+    } else {
+        out = fmt::format("{}\t{}\n", N, M);
+    }
     BGZF* fp = bgzf_open(opt::output.c_str(), "w");
     if (bgzf_write(fp, out.c_str(), out.length()) != out.length()) {
         throw std::runtime_error("ERROR: fail to write");
     }
-    // ready for run
-    String rg = pv.front() + pv.back();
-    int32_t rg_s, rg_e;
-    String chr;
-    std::tie(chr, rg_s, rg_e) = BaseVarC::splitrg(rg);
-    RefReader fa;
-    // expand right region for scanning indels
-    String rg_t = fmt::format("{}:{}-{}", chr, rg_s, rg_e + 1000);
-    String refseq = fa.GetTargetBase(rg_t, opt::reference);
-    int32_t count = 0;
-    for (int32_t i = 0; i < N; i++) {
-        BamProcess reader(opt::mapq);
-        if (!(++count % 1000)) std::cerr << "Processing the number " << count / 1000 << "k bam" << std::endl;
-        if (!reader.Open(bams[i])) {
-            throw std::runtime_error("ERROR: cannot open bam " + bams[i]);
-        }
-        String out = reader.FetchAlleleType(rg_s, refseq, rg, pv);
-        out += "\n";
-        if (bgzf_write(fp, out.c_str(), out.length()) != out.length()) {
-            throw std::runtime_error("ERROR: fail to write");
+    // ready for run. the sites are cut into clusters wherever the
+    // chromosome changes, the position goes back or jumps more than PM_GAP,
+    // so sparse or genome-wide posfiles only decode reads near their sites
+    std::vector<PmCluster> cls;
+    for (int32_t i = 0; i < M; ++i) {
+        if (i == 0 || pv[i].chr != pv[i - 1].chr || pv[i].pos < pv[i - 1].pos || pv[i].pos - pv[i - 1].pos > PM_GAP) {
+            cls.emplace_back();
         }
-        if (!reader.Close()) {
-            std::cerr << "warning: fail to close file " << bams[i] << std::endl;
+        cls.back().pv.push_back(pv[i]);
+    }
+    for (auto & c : cls) c.rg = c.pv.front() + c.pv.back();
+    std::cerr << "popmatrix reads " << M << " sites in " << cls.size() << " regions" << std::endl;
+    // one task per bam, rows are written in order by the writer. up to
+    // 4 * thread bams are in flight, the next ones are opened and read
+    // while a slow one holds the output back
+    const int thread = std::max(opt::thread, 1);
+    if (thread > 1) bgzf_mt(fp, thread, 256);
+    PmQueue queue(4 * thread);
+    std::exception_ptr werr;
+    std::thread writer(pm_w, std::ref(queue), fp, std::ref(werr));
+    try {
+        BaseVarC::ThreadPool pool(thread);
+        std::deque<std::future<void>> res;
+        for (int32_t i = 0; i < N; i++) {
+            // closed by a failed row or the writer, the error is below
+            if (!queue.wait(i)) break;
+            res.emplace_back(pool.enqueue(pm_f, std::cref(bams[i]), i, std::cref(cls), std::ref(queue)));
+            while (!res.empty() && res.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                res.front().get();
+                res.pop_front();
+            }
         }
+        for (auto && r : res) r.get();
+    } catch (...) {
+        // the failed task closed the queue, the writer stops before the error goes on
+        queue.close();
+        writer.join();
+        throw;
     }
+    queue.close();
+    writer.join();
+    if (werr) std::rethrow_exception(werr);
     if (bgzf_close(fp) < 0) std::cerr << "warning: fail to close file" << std::endl;
     clock_t cte = clock();
     double elapsed_secs = double(cte - ctb) / CLOCKS_PER_SEC;
@@ -728,6 +1904,280 @@ void runPopMatrix (int argc, char **argv)
     return;
 }
 
+void pm_f(const String& bam, size_t i, const std::vector<PmCluster>& cls, PmQueue& queue)
+{
+    try {
+        BamProcess reader(opt::mapq);
+        if (!reader.Open(bam)) {
+            throw std::runtime_error("ERROR: cannot open bam " + bam);
+        }
+        String out;
+        for (auto const& c : cls) {
+            // another row failed, nothing takes this one any more
+            if (!queue.wait(i)) return;
+            out += reader.FetchAlleleType(c.rg, c.pv);
+        }
+        if (opt::matrix_format == "bin") {
+            String row;
+            pm_pack(out, row);
+            out.swap(row);
+        } else {
+            out += "\n";
+        }
+        if (!reader.Close()) {
+            std::cerr << "warning: fail to close file " << bam << std::endl;
+        }
+        queue.push(i, std::move(out));
+    } catch (...) {
+        // let the writer and the other rows go, the error comes with the future
+        queue.close();
+        throw;
+    }
+}
+
+// the writer thread, as bt_w its error is kept for runPopMatrix and the
+// queue is closed so no more rows are read
+void pm_w(PmQueue& queue, BGZF* fp, std::exception_ptr& err)
+{
+    String out;
+    int32_t count = 0;
+    try {
+        while (queue.pop(out)) {
+            if (!(++count % 1000)) std::cerr << "Processing the number " << count / 1000 << "k bam" << std::endl;
+            if (bgzf_write(fp, out.c_str(), out.length()) != (ssize_t)out.length()) {
+                throw std::runtime_error("ERROR: fail to write");
+            }
+        }
+    } catch (...) {
+        err = std::current_exception();
+        queue.close();
+    }
+}
+
+void pm_pack(const String& row, String& out)
+{
+    out.assign((row.length() + 3) / 4, 0);
+    for (size_t j = 0; j < row.length(); ++j) {
+        const uint8_t c = row[j] == '0' ? 0 : (row[j] == '1' ? 1 : 2);
+        out[j >> 2] |= c << ((j & 3) << 1);
+    }
+}
+
+void pm_unpack(const String& row, int32_t m, String& out)
+{
+    static const char CODE2CHAR[4] = {'0', '1', '.', '.'};
+    out.resize(m);
+    for (int32_t j = 0; j < m; ++j) {
+        out[j] = CODE2CHAR[((uint8_t)row[j >> 2] >> ((j & 3) << 1)) & 3];
+    }
+}
+
+void pm_cat(String& out, int32_t n, const String& row, int32_t m)
+{
+    // append m packed calls to the n ones of out, bytes are copied as they
+    // are when n is a multiple of 4 and shifted into place otherwise
+    const int sh = (n & 3) << 1;
+    const size_t b = n >> 2, nb = (m + 3) >> 2;
+    if (!sh) {
+        out.append(row, 0, nb);
+        return;
+    }
+    out.resize((n + m + 3) >> 2, 0);
+    for (size_t t = 0; t < nb; ++t) {
+        const uint8_t c = row[t];
+        out[b + t] |= c << sh;
+        if (b + t + 1 < out.length()) out[b + t + 1] |= c >> (8 - sh);
+    }
+}
+
+BGZF* pm_open(const String& fn, int32_t& n, int32_t& m, String& sites, bool& bin, int64_t& hlen, bool* site_major)
+{
+    // text matrix starts with the "N\tM" line, binary one with the magic.
+    // a binary one of transpose has n rows of sites and m samples, it is
+    // only taken by the callers asking for site_major
+    BGZF* fp = bgzf_open(fn.c_str(), "r");
+    if (!fp) {
+        throw std::runtime_error("ERROR: fail to open " + fn);
+    }
+    char magic[sizeof(PMB_MAGIC)];
+    int32_t h[3];
+    const bool full = bgzf_read(fp, magic, sizeof(magic)) == sizeof(magic);
+    const bool tr = full && !memcmp(magic, PMT_MAGIC, sizeof(magic));
+    bin = tr || (full && !memcmp(magic, PMB_MAGIC, sizeof(magic)));
+    if (tr && !site_major) {
+        throw std::runtime_error("ERROR: " + fn + " is a transposed popmatrix, only pmview reads it");
+    }
+    if (site_major) *site_major = tr;
+    sites.clear();
+    if (bin) {
+        if (bgzf_read(fp, h, sizeof(h)) != sizeof(h) || h[2] < 0) {
+            throw std::runtime_error("ERROR: truncated header of " + fn);
+        }
+        n = h[0];
+        m = h[1];
+        sites.resize(h[2]);
+        if (bgzf_read(fp, &sites[0], h[2]) != h[2]) {
+            throw std::runtime_error("ERROR: truncated header of " + fn);
+        }
+        hlen = sizeof(magic) + sizeof(h) + h[2];
+        return fp;
+    }
+    if (bgzf_seek(fp, 0, SEEK_SET) < 0) {
+        throw std::runtime_error("ERROR: fail to seek in " + fn);
+    }
+    kstring_t ks = {0, 0, NULL};
+    if (bgzf_getline(fp, '\n', &ks) < 0 || sscanf(ks.s, "%d\t%d", &n, &m) != 2) {
+        throw std::runtime_error("ERROR: no matrix header in " + fn);
+    }
+    hlen = ks.l + 1;
+    free(ks.s);
+    return fp;
+}
+
+void pm_blocks(PmIn& in)
+{
+    // only the header and the ISIZE trailer of each block are read
+    FILE* fp = fopen(in.fn.c_str(), "rb");
+    if (!fp) {
+        throw std::runtime_error("ERROR: fail to open " + in.fn);
+    }
+    uint8_t h[18];
+    uint32_t isize;
+    int64_t coff = 0, uoff = 0, bsize;
+    in.coff.clear();
+    in.uoff.clear();
+    while (fread(h, 1, sizeof(h), fp) == sizeof(h)) {
+        if (h[0] != 31 || h[1] != 139 || h[12] != 'B' || h[13] != 'C') {
+            throw std::runtime_error("ERROR: " + in.fn + " is not bgzf compressed");
+        }
+        bsize = (h[16] | h[17] << 8) + 1;
+        if (fseeko(fp, coff + bsize - 4, SEEK_SET) != 0 || fread(&isize, 1, sizeof(isize), fp) != sizeof(isize)) {
+            throw std::runtime_error("ERROR: truncated bgzf block in " + in.fn);
+        }
+        in.coff.push_back(coff);
+        in.uoff.push_back(uoff);
+        coff += bsize;
+        uoff += isize;
+    }
+    fclose(fp);
+}
+
+void pm_seek(BGZF* fp, const PmIn& in, int64_t u)
+{
+    size_t b = std::upper_bound(in.uoff.begin(), in.uoff.end(), u) - in.uoff.begin();
+    if (b == 0 || bgzf_seek(fp, in.coff[b - 1] << 16 | (u - in.uoff[b - 1]), SEEK_SET) < 0) {
+        throw std::runtime_error("ERROR: fail to seek in " + in.fn);
+    }
+}
+
+void pm_cc(const std::vector<PmIn>& ins, int32_t n, int32_t rows, int thread, int ithread, PmQueue& queue)
+{
+    try {
+        // the blocks of rows go round-robin, each thread reads its rows
+        // of every input through its own file pointers
+        std::vector<BGZF*> fpv;
+        for (auto & in : ins) {
+            BGZF* fp = bgzf_open(in.fn.c_str(), "r");
+            if (!fp) throw std::runtime_error("ERROR: fail to open " + in.fn);
+            fpv.push_back(fp);
+        }
+        const bool bin = ins.front().bin;
+        const int32_t nblk = (n + rows - 1) / rows;
+        std::vector<String> out(rows);
+        String row, txt, gz;
+        for (int32_t c = ithread; c < nblk; c += thread) {
+            // closed when a block or the writer failed, stop reading
+            if (!queue.wait(c + 1)) break;
+            const int32_t r0 = c * rows, r1 = std::min(n, r0 + rows);
+            for (auto & o : out) o.clear();
+            int32_t m = 0;
+            for (size_t k = 0; k < ins.size(); m += ins[k++].m) {
+                const int64_t len = bin ? (ins[k].m + 3) / 4 : ins[k].m + 1;
+                pm_seek(fpv[k], ins[k], ins[k].hlen + r0 * len);
+                row.resize(len);
+                for (int32_t r = r0; r < r1; ++r) {
+                    if (bgzf_read(fpv[k], &row[0], len) != len || (!bin && row.back() != '\n')) {
+                        throw std::runtime_error("ERROR: bad or empty " + BaseVarC::tostring(r) + " row of " + ins[k].fn);
+                    }
+                    // packed rows are spliced without decoding the calls
+                    if (bin) pm_cat(out[r - r0], m, row, ins[k].m);
+                    else out[r - r0].append(row, 0, len - 1);
+                }
+            }
+            txt.clear();
+            for (int32_t r = r0; r < r1; ++r) {
+                txt += out[r - r0];
+                if (!bin) txt += '\n';
+            }
+            bt_gz(txt, gz, NULL);
+            queue.push(c + 1, std::move(gz));
+        }
+        for (auto & fp : fpv) bgzf_close(fp);
+    } catch (...) {
+        queue.close();
+        throw;
+    }
+}
+
+// the writer of concat, its error is kept as pm_w does
+void pm_cw(PmQueue& queue, FILE* fp, std::exception_ptr& err)
+{
+    String gz;
+    try {
+        while (queue.pop(gz)) bt_fw(fp, gz);
+    } catch (...) {
+        err = std::current_exception();
+        queue.close();
+    }
+}
+
+void pm_concat(const std::vector<PmIn>& ins, int32_t n, int32_t mt, const String& head, const String& fo)
+{
+    // joins the n rows of all inputs into fo after head, in blocks of
+    // about 4MB of rows. a block takes at least 1MB of every input, so
+    // narrow ones aren't inflated for a few bytes each time, as long as
+    // the blocks of all threads fit in --mem with their copies
+    FILE* fpo = fopen(fo.c_str(), "wb");
+    if (!fpo) {
+        throw std::runtime_error("ERROR: fail to open " + fo);
+    }
+    const bool bin = ins.front().bin;
+    const int thread = std::max(opt::thread, 1);
+    const int64_t width = std::max(1, bin ? (mt + 3) / 4 : mt + 1);
+    int64_t narrow = width;
+    for (auto & in : ins) narrow = std::min<int64_t>(narrow, bin ? (in.m + 3) / 4 : in.m + 1);
+    int64_t blk = std::max<int64_t>((1 << 22) / width, (1 << 20) / std::max<int64_t>(1, narrow));
+    blk = std::min(blk, ((int64_t)opt::mem << 20) / (3 * thread * width));
+    const int32_t rows = std::max<int64_t>(1, std::min<int64_t>(blk, n));
+    PmQueue queue(2 * thread + 1);
+    String gz;
+    bt_gz(head, gz, NULL);
+    queue.push(0, std::move(gz));
+    std::exception_ptr werr;
+    std::thread writer(pm_cw, std::ref(queue), fpo, std::ref(werr));
+    try {
+        BaseVarC::ThreadPool pool(thread);
+        std::vector<std::future<void>> res;
+        for (int i = 0; i < thread; ++i) {
+            res.emplace_back(pool.enqueue(pm_cc, std::cref(ins), n, rows, thread, i, std::ref(queue)));
+        }
+        for (auto && r : res) r.get();
+    } catch (...) {
+        queue.close();
+        writer.join();
+        fclose(fpo);
+        throw;
+    }
+    queue.close();
+    writer.join();
+    if (werr) {
+        fclose(fpo);
+        std::rethrow_exception(werr);
+    }
+    BaseVarC::eofbgzf(fpo);
+    if (fclose(fpo) != 0) std::cerr << "warning: fail to close file" << std::endl;
+}
+
 void runConcat(int argc, char **argv)
 {
     parseOptions(argc, argv, CONCAT_MESSAGE);
@@ -737,59 +2187,234 @@ void runConcat(int argc, char **argv)
     std::ifstream ifm(fm);
     StringV fm_v(std::istream_iterator<BaseVarC::Line>{ifm},
 	             std::istream_iterator<BaseVarC::Line>{});
-    int32_t i, k, m, n = 0, mt = 0;
-    int32_t nm = fm_v.size();
-    BGZF* fp = NULL;
-    BGZF* fpo = bgzf_open(fo.c_str(), "w");
-    kstring_t ks = {0, 0, NULL};
-    String ss;
-    // read head line and hold all file pointers
-    std::vector<BGZF*> fpv;
-    for (auto & fm : fm_v) {
-        fp = bgzf_open(fm.c_str(), "r");
-        fpv.push_back(fp);
-        if (bgzf_getline(fp, '\n', &ks) >= 0) {
-            ss = ks.s;
-            StringV tokens;
-            String token;
-            std::istringstream ts(ss);
-            while (std::getline(ts, token, '\t')) tokens.push_back(token);
-            if (n > 0 && n != std::stol(tokens[0])) {
-                throw std::runtime_error("ERROR: the number of samples among the inputs are different!");
-            } else {
-                n = std::stol(tokens[0]);
-                m = std::stol(tokens[1]);
-                mt += m;
+    if (fm_v.empty()) {
+        throw std::invalid_argument(CONCAT_MESSAGE);
+    }
+    int32_t k, n = 0, mt = 0;
+    String ss, sites, st;
+    bool b;
+    // read head line and map the blocks of each input
+    std::vector<PmIn> ins(fm_v.size());
+    for (size_t i = 0; i < fm_v.size(); ++i) {
+        PmIn& in = ins[i];
+        in.fn = fm_v[i];
+        bgzf_close(pm_open(in.fn, k, in.m, st, b, in.hlen));
+        if (i > 0 && b != ins[0].bin) {
+            throw std::runtime_error("ERROR: the inputs mix text and binary matrix!");
+        }
+        if (n > 0 && n != k) {
+            throw std::runtime_error("ERROR: the number of samples among the inputs are different!");
+        }
+        in.bin = b;
+        n = k;
+        mt += in.m;
+        sites += st;
+        pm_blocks(in);
+    }
+    if (ins[0].bin) {
+        const int32_t h[3] = {n, mt, (int32_t)sites.length()};
+        ss.assign(PMB_MAGIC, sizeof(PMB_MAGIC));
+        ss.append((const char*)h, sizeof(h));
+        ss += sites;
+    } else {
+        ss = fmt::format("{}\t{}\n", n, mt);
+    }
+    pm_concat(ins, n, mt, ss, fo);
+    clock_t cte = clock();
+    double elapsed_secs = double(cte - ctb) / CLOCKS_PER_SEC;
+    std::cout << "elapsed secs : " << elapsed_secs << std::endl;
+    std::cout << "concat done" << std::endl;
+
+    return;
+}
+
+void pm_tile(const PmIn& in, int32_t r0, int32_t r1, bool bin, const String& fn)
+{
+    // rows r0 to r1 of in, written out as a matrix of in.m rows of r1 - r0
+    // calls. the tile is turned over in 64x64 blocks so reads and writes
+    // both stay in cache
+    const int32_t m = in.m, R = r1 - r0;
+    const int64_t len = in.bin ? (m + 3) / 4 : m + 1;
+    BGZF* fp = bgzf_open(in.fn.c_str(), "r");
+    if (!fp) {
+        throw std::runtime_error("ERROR: fail to open " + in.fn);
+    }
+    pm_seek(fp, in, in.hlen + r0 * len);
+    std::vector<char> tile((size_t)R * m), tt((size_t)R * m);
+    String row(len, '\0'), out;
+    for (int32_t r = 0; r < R; ++r) {
+        if (bgzf_read(fp, &row[0], len) != len || (!in.bin && row.back() != '\n')) {
+            throw std::runtime_error("ERROR: bad or empty " + BaseVarC::tostring(r0 + r) + " row of " + in.fn);
+        }
+        if (in.bin) pm_unpack(row, m, out);
+        else out.assign(row, 0, m);
+        std::copy(out.begin(), out.end(), tile.begin() + (size_t)r * m);
+    }
+    bgzf_close(fp);
+    for (int32_t jb = 0; jb < m; jb += 64) {
+        for (int32_t rb = 0; rb < R; rb += 64) {
+            const int32_t je = std::min(jb + 64, m), re = std::min(rb + 64, R);
+            for (int32_t j = jb; j < je; ++j) {
+                for (int32_t r = rb; r < re; ++r) tt[(size_t)j * R + r] = tile[(size_t)r * m + j];
             }
         }
     }
-    // begin to concat and write to output
-    ss = fmt::format("{}\t{}\n", n, mt);
-    if (bgzf_write(fpo, ss.c_str(), ss.length()) != ss.length()) {
-        throw std::runtime_error("ERROR: fail to write");
+    BGZF* fo = bgzf_open(fn.c_str(), "w");
+    if (!fo) {
+        throw std::runtime_error("ERROR: fail to open " + fn);
+    }
+    if (bin) {
+        const int32_t h[3] = {m, R, 0};
+        out.assign(PMB_MAGIC, sizeof(PMB_MAGIC));
+        out.append((const char*)h, sizeof(h));
+    } else {
+        out = fmt::format("{}\t{}\n", m, R);
     }
-    for (i = 0; i < n ; ++i) {
-        if (i % 1000 == 0 && i != 0) std::cout << "reading the " << i << " samples" << std::endl;
-        ss = "";
-        ss.reserve(mt+1);
-        for (k = 0; k < nm; ++k) {
-            if (bgzf_getline(fpv[k], '\n', &ks) >= 0) {
-                ss += (String)ks.s;
+    for (int32_t j = 0; j < m; ++j) {
+        row.assign(tt.begin() + (size_t)j * R, tt.begin() + (size_t)(j + 1) * R);
+        if (bin) {
+            String pk;
+            pm_pack(row, pk);
+            out += pk;
+        } else {
+            out += row;
+            out += '\n';
+        }
+        if (out.length() >= (1 << 20) || j + 1 == m) {
+            if (bgzf_write(fo, out.c_str(), out.length()) != (ssize_t)out.length()) {
+                throw std::runtime_error("ERROR: fail to write");
+            }
+            out.clear();
+        }
+    }
+    if (bgzf_close(fo) < 0) std::cerr << "warning: fail to close file" << std::endl;
+}
+
+void runTranspose(int argc, char **argv)
+{
+    parseOptions(argc, argv, TRANSPOSE_MESSAGE);
+    if (opt::matrix_format != "txt" && opt::matrix_format != "bin") {
+        throw std::invalid_argument("matrix format must be txt or bin");
+    }
+    clock_t ctb = clock();
+    const bool bin = opt::matrix_format == "bin";
+    const int thread = std::max(opt::thread, 1);
+    int32_t n;
+    String sites;
+    PmIn in;
+    in.fn = opt::input;
+    bgzf_close(pm_open(in.fn, n, in.m, sites, in.bin, in.hlen));
+    pm_blocks(in);
+    // out of core. tiles of whole rows, as many as fit in --mem with two
+    // copies each, are turned into site-major matrices of their samples.
+    // those are then joined side by side like concat does
+    const int64_t R = std::max<int64_t>(1, std::min<int64_t>(n, ((int64_t)opt::mem << 20) / (2 * (int64_t)thread * std::max(1, in.m))));
+    const int32_t ntile = (n + R - 1) / R;
+    std::vector<PmIn> tiles(ntile);
+    {
+        BaseVarC::ThreadPool pool(thread);
+        std::vector<std::future<void>> res;
+        for (int32_t t = 0; t < ntile; ++t) {
+            tiles[t].fn = fmt::format("{}.tmp.tile.{}", opt::output, t);
+            res.emplace_back(pool.enqueue(pm_tile, std::cref(in), t * R, std::min<int64_t>(n, (t + 1) * R), bin, std::cref(tiles[t].fn)));
+        }
+        for (auto && r : res) r.get();
+    }
+    std::cerr << "transposed " << ntile << " tiles of " << R << " samples" << std::endl;
+    int32_t k;
+    String st, head;
+    for (auto & t : tiles) {
+        bgzf_close(pm_open(t.fn, k, t.m, st, t.bin, t.hlen));
+        pm_blocks(t);
+    }
+    // no more than PM_FANIN tiles are joined at once, so the files open and
+    // the blocks read of each tile stay bounded. the groups are joined into
+    // wider tiles until the last pass takes them all
+    for (int level = 0; tiles.size() > PM_FANIN; ++level) {
+        std::vector<PmIn> wide((tiles.size() + PM_FANIN - 1) / PM_FANIN);
+        for (size_t g = 0; g < wide.size(); ++g) {
+            std::vector<PmIn> part(tiles.begin() + g * PM_FANIN, tiles.begin() + std::min(tiles.size(), (g + 1) * PM_FANIN));
+            int32_t w = 0;
+            for (auto & t : part) w += t.m;
+            if (bin) {
+                const int32_t h[3] = {in.m, w, 0};
+                head.assign(PMB_MAGIC, sizeof(PMB_MAGIC));
+                head.append((const char*)h, sizeof(h));
             } else {
-                throw std::runtime_error("ERROR: empty in the " + BaseVarC::tostring(i) + " line of " + fm_v[k]);
+                head = fmt::format("{}\t{}\n", in.m, w);
+            }
+            wide[g].fn = fmt::format("{}.tmp.tile.{}.{}", opt::output, level, g);
+            pm_concat(part, in.m, w, head, wide[g].fn);
+            if (!opt::keep_tmp) {
+                for (auto & t : part) std::remove(t.fn.c_str());
             }
+            bgzf_close(pm_open(wide[g].fn, k, wide[g].m, st, wide[g].bin, wide[g].hlen));
+            pm_blocks(wide[g]);
         }
-        ss += "\n";
-        if (bgzf_write(fpo, ss.c_str(), ss.length()) != ss.length()) {
+        tiles.swap(wide);
+        std::cerr << "joined them into " << tiles.size() << " tiles" << std::endl;
+    }
+    if (bin) {
+        const int32_t h[3] = {in.m, n, (int32_t)sites.length()};
+        head.assign(PMT_MAGIC, sizeof(PMT_MAGIC));
+        head.append((const char*)h, sizeof(h));
+        head += sites;
+    } else {
+        head = fmt::format("{}\t{}\n", in.m, n);
+    }
+    if (!tiles.empty()) {
+        pm_concat(tiles, in.m, n, head, opt::output);
+    } else {
+        BGZF* fo = bgzf_open(opt::output.c_str(), "w");
+        if (!fo || bgzf_write(fo, head.c_str(), head.length()) != (ssize_t)head.length()) {
             throw std::runtime_error("ERROR: fail to write");
         }
+        bgzf_close(fo);
+    }
+    if (!opt::keep_tmp) {
+        for (auto & t : tiles) std::remove(t.fn.c_str());
     }
-
-    if (bgzf_close(fpo) < 0) std::cerr << "warning: fail to close file" << std::endl;
     clock_t cte = clock();
     double elapsed_secs = double(cte - ctb) / CLOCKS_PER_SEC;
     std::cout << "elapsed secs : " << elapsed_secs << std::endl;
-    std::cout << "concat done" << std::endl;
+    std::cout << "transpose done" << std::endl;
+
+    return;
+}
+
+void runPmView(int argc, char **argv)
+{
+    parseOptions(argc, argv, PMVIEW_MESSAGE);
+    int32_t n, m;
+    String sites;
+    bool bin;
+    int64_t hlen;
+    bool tr;
+    // a transposed one has the same rows of packed calls, just one per site
+    BGZF* fi = pm_open(opt::input, n, m, sites, bin, hlen, &tr);
+    if (!bin) {
+        throw std::runtime_error("ERROR: " + opt::input + " is not a binary popmatrix");
+    }
+    const bool plain = opt::output == "-";
+    BGZF* fo = bgzf_open(opt::output.c_str(), plain ? "wu" : "w");
+    if (!fo) {
+        throw std::runtime_error("ERROR: fail to open " + opt::output);
+    }
+    String out = fmt::format("{}\t{}\n", n, m), row((m + 3) / 4, 0), txt;
+    for (int32_t i = 0; i <= n; ++i) {
+        if (bgzf_write(fo, out.c_str(), out.length()) != (ssize_t)out.length()) {
+            throw std::runtime_error("ERROR: fail to write");
+        }
+        if (i == n) break;
+        if (bgzf_read(fi, &row[0], row.length()) != (ssize_t)row.length()) {
+            throw std::runtime_error("ERROR: empty in the " + BaseVarC::tostring(i) + " row of " + opt::input);
+        }
+        pm_unpack(row, m, out);
+        out += '\n';
+    }
+    bgzf_close(fi);
+    if (bgzf_close(fo) < 0) std::cerr << "warning: fail to close file" << std::endl;
+    std::cerr << "pmview done" << std::endl;
 
     return;
 }
@@ -811,6 +2436,14 @@ void parseOptions(int argc, char **argv, const char* msg)
         case 'g': arg >> opt::group; break;
         case 'o': arg >> opt::output; break;
         case 'a': arg >> opt::maf; break;
+        case 17 : arg >> opt::mem; break;
+        case 16 : arg >> opt::matrix_format; break;
+        case 15 : arg >> opt::cvg_format; break;
+        case 14 : arg >> opt::compress_thread; break;
+        case 13 : opt::sites_only = true; break;
+        case 12 : arg >> opt::output_format; break;
+        case 10 : arg >> opt::em_depth; break;
+        case  9 : arg >> opt::lrt_cache; break;
         case  8 : opt::rerun   = true; break;
         case  7 : opt::load    = true; break;
         case  6 : opt::keep_tmp= true; break;
@@ -8,6 +8,7 @@
 #include <numeric>
 #include <algorithm>
 #include <cstdio>
+#include <stdexcept>
 
 namespace BaseVarC
 {
@@ -45,6 +46,19 @@ inline bool exists (const std::string& name) {
     }
 }
 
+// the empty block bgzf appends when a file is closed
+static const char BGZF_EOF[28] = {
+    '\037', '\213', '\010', '\004', 0, 0, 0, 0, 0, '\377', 6, 0, 'B', 'C', 2, 0,
+    '\033', 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// terminate a file written as raw bgzf blocks
+inline void eofbgzf(FILE* fo) {
+    if (fwrite(BGZF_EOF, 1, sizeof(BGZF_EOF), fo) != sizeof(BGZF_EOF)) {
+        throw std::runtime_error("ERROR: fail to write");
+    }
+}
+
 inline bool checkrg(const std::string& rg) {
     if (rg.find(":") == std::string::npos) {
         throw std::invalid_argument("region must be feed with samtools-like format, i.e. chr:start-end");
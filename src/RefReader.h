@@ -11,18 +11,25 @@ class RefReader: public SeqLib::RefGenome
     ~RefReader(){}
     // rg is samtools-like region
     std::string GetTargetBase(const std::string& rg, const std::string& f);
+    // the same with the index loaded already, for many regions
+    std::string GetTargetBase(const std::string& rg);
 
 };
 
 std::string RefReader::GetTargetBase(const std::string& rg, const std::string& f)
+{
+    if (!LoadIndex(f)) {
+        throw std::runtime_error("ERROR: reference must be index with samtools faidx");
+    }
+    return GetTargetBase(rg);
+}
+
+std::string RefReader::GetTargetBase(const std::string& rg)
 {
     std::string chr;
     std::string seq;
     int32_t rg_s, rg_e;
     std::tie(chr, rg_s, rg_e) = BaseVarC::splitrg(rg);
-    if (!LoadIndex(f)) {
-        throw std::runtime_error("ERROR: reference must be index with samtools faidx");
-    }
     // SeqLib will throw exception if something goes wrong.
     seq = QueryRegion(chr, rg_s - 1, rg_e - 1);    // make 0-based
     for (auto & i: seq) {    // may contain '-' character
@@ -0,0 +1,72 @@
+#ifndef REORDER_QUEUE_H
+#define REORDER_QUEUE_H
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+namespace BaseVarC {
+
+// hands items numbered 0, 1, 2... from many producers to one consumer in
+// order. a producer waits while its item is capacity or more ahead of the
+// consumer, so only a bounded number of items is held at any time
+template<typename T>
+class ReorderQueue {
+public:
+    ReorderQueue(size_t capacity) : capacity(capacity) {}
+
+    // wait until item seq can be pushed without blocking, false if the
+    // queue was closed meanwhile
+    bool wait(size_t seq)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this, seq]{ return closed || seq < next + capacity; });
+        return !closed;
+    }
+
+    // items pushed after close are dropped
+    void push(size_t seq, T&& item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        not_full.wait(lock, [this, seq]{ return closed || seq < next + capacity; });
+        if (closed) return;
+        pending.emplace(seq, std::move(item));
+        if (seq == next) ready.notify_one();
+    }
+
+    // the next item in order, false when closed and nothing is left
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        ready.wait(lock, [this]{ return closed || pending.count(next); });
+        auto it = pending.find(next);
+        if (it == pending.end()) return false;
+        item = std::move(it->second);
+        pending.erase(it);
+        ++next;
+        not_full.notify_all();
+        return true;
+    }
+
+    // no more items will be pushed, also lets waiting producers go when
+    // one of them fails
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        closed = true;
+        ready.notify_one();
+        not_full.notify_all();
+    }
+
+private:
+    const size_t capacity;
+    size_t next = 0;
+    bool closed = false;
+    std::map<size_t, T> pending;
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::condition_variable not_full;
+};
+
+}
+#endif
@@ -0,0 +1,246 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+
+namespace BaseVarC {
+
+// counts the unfinished tasks of one piece of work and keeps the first
+// error thrown by them
+class TaskGroup {
+public:
+    TaskGroup(): left(0) {}
+
+    // wait until all tasks are done, then rethrow the first error
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [this]{ return left == 0; });
+        if (err) std::rethrow_exception(err);
+    }
+
+private:
+    friend class TaskScheduler;
+
+    void add()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        ++left;
+    }
+
+    // under the lock, so wait() can't return and drop the group before
+    // the last task let go of it
+    void finish(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (e && !err) err = e;
+        if (--left == 0) done.notify_all();
+    }
+
+    size_t left;
+    std::exception_ptr err;
+    std::mutex mtx;
+    std::condition_variable done;
+};
+
+// a task is a plain function with two words of arguments, submitting one
+// copies it into a ring allocated up front
+struct Task {
+    void (*run)(void*, size_t);
+    void* ctx;
+    size_t arg;
+    TaskGroup* group;
+};
+
+// a fixed ring of tasks. its worker pushes and pops at the back, so it
+// keeps working on what it just made, thieves take the oldest from the front
+class TaskDeque {
+public:
+    TaskDeque(size_t capacity): ring(capacity), head(0), tail(0) {}
+
+    bool push(const Task& t)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (tail - head == ring.size()) return false;
+        ring[tail++ % ring.size()] = t;
+        return true;
+    }
+
+    bool pop(Task& t)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (tail == head) return false;
+        t = ring[--tail % ring.size()];
+        return true;
+    }
+
+    bool steal(Task& t)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (tail == head) return false;
+        t = ring[head++ % ring.size()];
+        return true;
+    }
+
+private:
+    std::vector<Task> ring;
+    size_t head, tail;
+    std::mutex mtx;
+};
+
+// work-stealing pool: one deque per worker, an idle worker steals from the
+// others before it sleeps. tasks must not block on other tasks, a task
+// that has to wait calls help() and runs tasks meanwhile
+class TaskScheduler {
+public:
+    TaskScheduler(size_t threads, size_t depth = 4096);
+    ~TaskScheduler();
+
+    // from a worker the task goes to its own deque and runs right away if
+    // that is full, from other threads the deques are filled in turn
+    void submit(TaskGroup& group, void (*run)(void*, size_t), void* ctx, size_t arg);
+
+    // run tasks until ready() holds, other threads just wait for it
+    template<class P>
+    void help(P ready);
+
+    size_t size() const { return workers.size(); }
+
+    // the worker of the calling thread, -1 if it is not one of ours
+    int index() const { return self().pool == this ? self().index : -1; }
+
+private:
+    struct Self {
+        const TaskScheduler* pool;
+        int index;
+    };
+    static Self& self()
+    {
+        static thread_local Self s = {NULL, -1};
+        return s;
+    }
+
+    bool take(int me, Task& t);
+    void execute(const Task& t);
+
+    std::vector< std::unique_ptr<TaskDeque> > deques;
+    std::vector< std::thread > workers;
+    std::atomic<size_t> pending;    // tasks sitting in the deques
+    std::atomic<size_t> idle;
+    std::atomic<size_t> turn;
+    std::mutex mtx;
+    std::condition_variable wake;
+    bool stop;
+};
+
+inline TaskScheduler::TaskScheduler(size_t threads, size_t depth)
+    :   pending(0), idle(0), turn(0), stop(false)
+{
+    if (threads < 1) threads = 1;
+    for (size_t i = 0; i < threads; ++i) deques.emplace_back(new TaskDeque(depth));
+    for (size_t i = 0; i < threads; ++i)
+        workers.emplace_back(
+            [this, i]
+            {
+                self().pool = this;
+                self().index = i;
+                Task t;
+                for (;;) {
+                    if (take(i, t)) {
+                        execute(t);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock(mtx);
+                    ++idle;
+                    wake.wait(lock, [this]{ return stop || pending > 0; });
+                    --idle;
+                    if (stop && pending == 0) return;
+                }
+            }
+        );
+}
+
+inline void TaskScheduler::submit(TaskGroup& group, void (*run)(void*, size_t), void* ctx, size_t arg)
+{
+    const Task t = {run, ctx, arg, &group};
+    const int me = index();
+    group.add();
+    // counted ahead of the push, a thief may take it at once
+    ++pending;
+    if (me >= 0) {
+        if (!deques[me]->push(t)) {
+            --pending;
+            execute(t);
+            return;
+        }
+    } else {
+        const size_t n = deques.size();
+        for (bool ok = false; !ok; ) {
+            const size_t k = turn++;
+            for (size_t i = 0; i < n && !ok; ++i) ok = deques[(k + i) % n]->push(t);
+            if (!ok) std::this_thread::yield();
+        }
+    }
+    if (idle > 0) {
+        std::lock_guard<std::mutex> lock(mtx);
+        wake.notify_one();
+    }
+}
+
+template<class P>
+void TaskScheduler::help(P ready)
+{
+    const int me = index();
+    Task t;
+    while (!ready()) {
+        if (me >= 0 && take(me, t)) {
+            execute(t);
+            continue;
+        }
+        // ready() is not signalled, look again now and then
+        std::unique_lock<std::mutex> lock(mtx);
+        wake.wait_for(lock, std::chrono::milliseconds(1), [this, me, &ready]{ return (me >= 0 && pending > 0) || ready(); });
+    }
+}
+
+inline bool TaskScheduler::take(int me, Task& t)
+{
+    const size_t n = deques.size();
+    bool ok = deques[me]->pop(t);
+    for (size_t i = 1; i < n && !ok; ++i) ok = deques[(me + i) % n]->steal(t);
+    if (ok) --pending;
+    return ok;
+}
+
+inline void TaskScheduler::execute(const Task& t)
+{
+    std::exception_ptr e;
+    try {
+        t.run(t.ctx, t.arg);
+    } catch (...) {
+        e = std::current_exception();
+    }
+    t.group->finish(e);
+}
+
+// the tasks left are run before the workers leave
+inline TaskScheduler::~TaskScheduler()
+{
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker: workers)
+        worker.join();
+}
+
+}
+#endif